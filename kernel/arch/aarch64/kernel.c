@@ -15,6 +15,11 @@ void kernel_arch_get_segment(enum kernel_segments seg, void **start, void **end)
         LOGF_P("Yet to be implemented\n");
 }
 
+unsigned kernel_arch_get_cpu_id(void)
+{
+        return (0);
+}
+
 union vm_arch_page_dir *kernel_arch_get_early_pg_root(void)
 {
         LOGF_P("Yet to be implemented\n");
@@ -38,6 +38,11 @@ boot_paging_pd:
 boot_paging_pt:
         .skip PLATFORM_PAGE_SIZE
 
+/* Page Table of the kmap window. It stays in use after the boot. */
+.global boot_paging_kmap
+boot_paging_kmap:
+        .skip PLATFORM_PAGE_SIZE
+
 .section .text
 /* The kernel's entry point */
 .global _start
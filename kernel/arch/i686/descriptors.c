@@ -59,8 +59,62 @@ static struct gdt_structure {
         struct gdt_entry null_descriptor;
         struct gdt_entry code_descriptor;
         struct gdt_entry data_descriptor;
+        struct gdt_entry boot_tss_descriptor;
+        struct gdt_entry df_tss_descriptor;
 } __attribute__((packed, aligned(8))) GDT;
 
+/**
+ * struct tss - the structure holds the state of a hardware task.
+ * The CPU saves the current state to the TSS of the current task on a task switch,
+ * and loads the state of the new task from its TSS.
+ * See Intel's Vol. 3A: 8-5
+ */
+struct tss {
+        uint16_t link;
+        uint16_t reserved_0;
+        uint32_t esp0;
+        uint16_t ss0;
+        uint16_t reserved_1;
+        uint32_t esp1;
+        uint16_t ss1;
+        uint16_t reserved_2;
+        uint32_t esp2;
+        uint16_t ss2;
+        uint16_t reserved_3;
+        uint32_t cr3;
+        uint32_t eip;
+        uint32_t eflags;
+        uint32_t eax;
+        uint32_t ecx;
+        uint32_t edx;
+        uint32_t ebx;
+        uint32_t esp;
+        uint32_t ebp;
+        uint32_t esi;
+        uint32_t edi;
+        uint16_t es;
+        uint16_t reserved_4;
+        uint16_t cs;
+        uint16_t reserved_5;
+        uint16_t ss;
+        uint16_t reserved_6;
+        uint16_t ds;
+        uint16_t reserved_7;
+        uint16_t fs;
+        uint16_t reserved_8;
+        uint16_t gs;
+        uint16_t reserved_9;
+        uint16_t ldt_selector;
+        uint16_t reserved_10;
+        uint16_t trap;
+        uint16_t iomap_base;
+} __attribute__((packed));
+
+/* The task that runs the kernel. The CPU only needs it to save the state on a task switch. */
+static struct tss BOOT_TSS;
+/* The task that handles double faults on a stack of its own. */
+static struct tss DF_TSS;
+
 struct idt_entry {
         uint16_t offset_low;
         uint16_t seg_selector;
@@ -105,6 +159,25 @@ static void gdt_set_table(struct gdt_ptr *table, uint16_t data_offset, uint16_t
 end:;
 }
 
+static void gdt_set_tss(struct gdt_entry *e, struct tss *tss)
+{
+        uint32_t const base = (uint32_t)tss;
+        uint32_t const limit = sizeof(*tss) - 1;
+
+        kmemset(e, 0, sizeof(*e));
+        e->limit_low = limit & 0xFFFF;
+        e->limit_high = (limit >> 0x10) & 0x0F;
+        e->base_low = base & 0xFFFF;
+        e->base_middle = (base >> 0x10) & 0xFF;
+        e->base_high = (uint8_t)(base >> 0x18);
+        /* Type 0x9: an available 32-bit TSS. */
+        e->accessed = true;
+        e->code = true;
+        e->code_or_data = false;
+        e->privelege = 0;
+        e->present = true;
+}
+
 static void idt_set_table(struct idt_ptr *table)
 {
         barrier_compiler();
@@ -177,6 +250,55 @@ void idt_set_gatedesc(uint8_t gate_num, void *offset, enum idt_flag flags, enum
         e->type = gt;
 }
 
+void idt_set_taskgate(uint8_t gate_num, uint16_t tss_selector)
+{
+        struct idt_entry *e = &IDT.gates[gate_num];
+
+        e->offset_low = 0;
+        e->offset_high = 0;
+        e->seg_selector = tss_selector;
+        e->must_be_0 = 0;
+        e->flags = IDT_FLAG_PRESENT | IDT_FLAG_RING_0;
+        e->type = GATE_TYPE_TASK_32;
+}
+
+void boot_setup_double_fault_task(void (*handler)(void), void *stack_top)
+{
+        uint16_t const code_sel = offsetof(struct gdt_structure, code_descriptor);
+        uint16_t const data_sel = offsetof(struct gdt_structure, data_descriptor);
+        uint16_t const boot_sel = offsetof(struct gdt_structure, boot_tss_descriptor);
+        uint16_t const df_sel = offsetof(struct gdt_structure, df_tss_descriptor);
+
+        /* A task switch saves the current state to the TSS of the current task,
+         * so the kernel must have one before the first switch. */
+        kmemset(&BOOT_TSS, 0, sizeof(BOOT_TSS));
+        BOOT_TSS.iomap_base = sizeof(BOOT_TSS);
+        gdt_set_tss(&GDT.boot_tss_descriptor, &BOOT_TSS);
+
+        barrier_compiler();
+        asm volatile("ltr %[sel]" : : [sel] "r"(boot_sel));
+
+        uint32_t cr3;
+        asm volatile("movl %%cr3, %[cr3]" : [cr3] "=r"(cr3));
+
+        kmemset(&DF_TSS, 0, sizeof(DF_TSS));
+        DF_TSS.cr3 = cr3;
+        DF_TSS.eip = (uint32_t)handler;
+        /* Reserved bit 1 must be set. Interrupts stay disabled. */
+        DF_TSS.eflags = 0x2;
+        DF_TSS.esp = (uint32_t)stack_top;
+        DF_TSS.cs = code_sel;
+        DF_TSS.ss = data_sel;
+        DF_TSS.ds = data_sel;
+        DF_TSS.es = data_sel;
+        DF_TSS.fs = data_sel;
+        DF_TSS.gs = data_sel;
+        DF_TSS.iomap_base = sizeof(DF_TSS);
+        gdt_set_tss(&GDT.df_tss_descriptor, &DF_TSS);
+
+        idt_set_taskgate(0x8, df_sel);
+}
+
 void boot_setup_idt(void)
 {
         kmemset(&IDT, 0, sizeof(IDT));
@@ -1,8 +1,13 @@
 #include "arch_i686/exceptions.h"
 
+#include "arch_i686/descriptors.h"
 #include "arch_i686/intr.h"
+#include "arch_i686/vm.h"
 
+#include "kernel/config.h"
 #include "kernel/kernel.h"
+#include "kernel/klog.h"
+#include "kernel/mm/kstack.h"
 #include "kernel/panic.h"
 
 #include "lib/cstd/inttypes.h"
@@ -84,7 +89,23 @@ static void default_handler(struct intr_ctx *ctx)
         kernel_panic(&i);
 }
 
+static uint8_t DOUBLE_FAULT_STACK[CONF_STACK_SIZE] __aligned(16);
+
+/* Runs as a separate task, so it's never entered on the stack that has failed. */
+__noreturn static void double_fault_task(void)
+{
+        /* A page fault that couldn't be delivered leaves its address behind. */
+        void *const fault_at = i686_vm_get_cr2();
+        if (kstack_is_guard(fault_at)) {
+                LOGF_P("Kernel stack overflow at %p!\n", fault_at);
+        }
+
+        LOGF_P("Double fault! The last page fault was at %p\n", fault_at);
+}
+
 void i686_setup_exception_handlers(void)
 {
         intr_handler_cpu_default(default_handler);
+        boot_setup_double_fault_task(double_fault_task,
+                                     &DOUBLE_FAULT_STACK[ARRAY_SIZE(DOUBLE_FAULT_STACK)]);
 }
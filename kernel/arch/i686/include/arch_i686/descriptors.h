@@ -5,6 +5,7 @@
 #include <stdint.h>
 
 enum gate_type {
+        GATE_TYPE_TASK_32 = 0x5,
         GATE_TYPE_INTER_16 = 0x6,
         GATE_TYPE_TRAP_16 = 0x7,
         GATE_TYPE_INTER_32 = 0xE,
@@ -23,5 +24,15 @@ enum idt_flag {
 void boot_setup_gdt(void);
 void boot_setup_idt(void);
 void idt_set_gatedesc(uint8_t gate_num, void *offset, enum idt_flag flags, enum gate_type gt);
+void idt_set_taskgate(uint8_t gate_num, uint16_t tss_selector);
+
+/**
+ * @brief Handle double faults in a separate task.
+ *
+ * An exception that can't be delivered on the current stack (e.g. a stack overflow) ends up
+ * as a double fault. The task switch gives the handler a known good stack.
+ * The handler must never return.
+ */
+void boot_setup_double_fault_task(void (*handler)(void), void *stack_top);
 
 #endif /* _KERNEL_ARCH_I686_DESCRIPTORS_H */
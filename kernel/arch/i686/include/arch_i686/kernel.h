@@ -9,6 +9,7 @@
 
 extern union i686_vm_arch_pd boot_paging_pd asm("boot_paging_pd");
 extern union i686_vm_arch_pd boot_paging_pt asm("boot_paging_pt");
+extern union i686_vm_arch_pd boot_paging_kmap asm("boot_paging_kmap");
 
 extern char kernel_bootstack_start[] asm("bootstack_top");
 extern char kernel_bootstack_end[] asm("bootstack_bottom");
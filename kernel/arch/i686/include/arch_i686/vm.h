@@ -27,10 +27,17 @@ enum i686_vm_dir_flags {
         I686VM_DIR_FLAG_4MiB = 0x1 << 6,
 };
 
+/* The meaning of the kernel_data bits of a Page Directory entry. */
+enum i686_vm_dir_kdata {
+        I686VM_DIR_KDATA_RECLAIMABLE = 0x1 << 0, /**< The table is counted and freed when empty. */
+};
+
 /**
  * @brief Converts vm_flags to i686_table flags.
+ *
+ * The memory type depends on whether the PAT has been set up.
  */
-__const enum i686_vm_table_flags i686_vm_to_table_flags(enum vm_flags area_flags);
+__pure enum i686_vm_table_flags i686_vm_to_table_flags(enum vm_flags area_flags);
 
 /**
  * @brief Converts vm_flags to i686_dir flags.
@@ -71,15 +78,16 @@ struct i686_vm_pge {
         };
 };
 
+#define I686VM_PT_ENTRIES         (1024U)
 #define I686VM_PD_LAST_VALID_PAGE (1021U)
-#define I686VM_PD_EMERGENCY_NDX   (1022U)
-#define I686VM_PD_EMERGENCY_ADDR  ((void *)(I686VM_PD_EMERGENCY_NDX << 22))
+#define I686VM_PD_KMAP_NDX        (1022U)
+#define I686VM_PD_KMAP_ADDR       ((void *)(I686VM_PD_KMAP_NDX << 22))
 #define I686VM_PD_RECURSIVE_NDX   (1023U)
 #define I686VM_PD_RECURSIVE_ADDR  ((void *)(I686VM_PD_RECURSIVE_NDX << 22))
 
 struct i686_vm_pd {
         struct i686_vm_pge entries[I686VM_PD_LAST_VALID_PAGE + 1];
-        struct i686_vm_pge emergency; /**< Page Tables don't have this. */
+        struct i686_vm_pge kmap; /**< Page Tables don't have this. */
         struct i686_vm_pge recursive;
 };
 
@@ -129,6 +137,11 @@ void i686_vm_set_pt(struct i686_vm_pd *root_dir);
 */
 void i686_vm_paging_enable(uintptr_t hh_offset);
 
+/**
+* @brief Make read-only pages read-only for the kernel too.
+*/
+void i686_vm_write_protect_enable(void);
+
 void *i686_vm_get_cr2(void);
 
 /**
@@ -136,6 +149,21 @@ void *i686_vm_get_cr2(void);
  */
 void i686_vm_pg_fault_handler(struct intr_ctx *ctx);
 
+/**
+ * @brief Program the Page Attribute Table, so that the PAT bit of a table entry selects
+ * the Write-Combining memory type.
+ *
+ * Does nothing if the CPU doesn't support PAT. Write-Combining mappings are uncached then.
+ */
+void i686_vm_setup_pat(void);
+
 void i686_vm_setup_recursive_mapping(struct i686_vm_pd *dir, void *dir_paddr);
 
+/**
+ * @brief Install the page table that backs the kmap window.
+ *
+ * Every Page Directory must point at the same table, so the slots are shared by all spaces.
+ */
+void i686_vm_setup_kmap(struct i686_vm_pd *dir, void *table_paddr);
+
 #endif /* _KERNEL_ARCH_I686_VM_H */
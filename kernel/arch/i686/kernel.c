@@ -45,6 +45,49 @@ void kernel_arch_get_segment(enum kernel_segments seg, void **start, void **end)
         }
 }
 
+/* Only the boot CPU is brought up, so every per-CPU array has a single entry. */
+kstatic_assert(CONF_MAX_CPUS == 1, "Other CPUs must be started and identified by APIC IDs.");
+
+unsigned kernel_arch_get_cpu_id(void)
+{
+        /* The kernel runs on the boot CPU only. */
+        return (0);
+}
+
+void kernel_arch_switch_stack(void *stack_top, void (*fn)(void))
+{
+        /* The function starts a new chain of frames. */
+        asm volatile("movl %[top], %%esp \n\t\
+                      xorl %%ebp, %%ebp \n\t\
+                      call *%[fn] \n\t\
+                      ud2"
+                     :
+                     : [top] "r"(stack_top), [fn] "r"(fn)
+                     : "memory");
+        __builtin_unreachable();
+}
+
+#define EFLAGS_IF (0x1U << 9)
+
+bool kernel_arch_irq_save(void)
+{
+        uint32_t eflags = 0;
+        asm volatile("pushfl \n\t\
+                      popl %[flags] \n\t\
+                      cli"
+                     : [flags] "=r"(eflags)
+                     :
+                     : "memory");
+        return (eflags & EFLAGS_IF);
+}
+
+void kernel_arch_irq_restore(bool enabled)
+{
+        if (enabled) {
+                irq_enable();
+        }
+}
+
 struct arch_info_i686 I686_INFO;
 
 void i686_init(multiboot_info_t *info, uint32_t magic)
@@ -56,6 +99,7 @@ void i686_init(multiboot_info_t *info, uint32_t magic)
 
         setup_boot_paging();
         addr_set_offset(KERNEL_VM_OFFSET);
+        i686_vm_setup_pat();
 
         boot_setup_gdt();
         boot_setup_idt();
@@ -142,6 +142,7 @@ static void register_bios_vga(void)
         union resource_data d = { .dev_buffer = {
                                           .base = (void *)0xA0000,
                                           .len = 128 * 1024,
+                                          .kind = RESOURCE_BUFFER_FRAMEBUFFER,
                                   } };
         resources_register("platform", "video", RESOURCE_TYPE_DEV_BUFFER, d);
 }
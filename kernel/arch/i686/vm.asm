@@ -35,3 +35,14 @@ i686_vm_paging_enable:
 1:
         ret
 .size i686_vm_paging_enable, . - i686_vm_paging_enable
+
+.global i686_vm_write_protect_enable
+.type   i686_vm_write_protect_enable, @function
+
+i686_vm_write_protect_enable:
+        /* Set CR0.WP */
+        movl %cr0, %eax
+        orl  $(0x1 << 16), %eax
+        movl %eax, %cr0
+        ret
+.size i686_vm_write_protect_enable, . - i686_vm_write_protect_enable
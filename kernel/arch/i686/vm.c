@@ -4,6 +4,7 @@
 #include "arch_i686/kernel.h"
 
 #include "kernel/config.h"
+#include "kernel/deferred.h"
 #include "kernel/kernel.h"
 #include "kernel/klog.h"
 #include "kernel/mm/addr.h"
@@ -14,23 +15,24 @@
 #include "lib/cppdefs.h"
 #include "lib/cstd/assert.h"
 #include "lib/cstd/string.h"
-#include "lib/ds/rbtree.h"
 #include "lib/sync/barriers.h"
+#include "lib/utils.h"
 
 #include <stdbool.h>
 #include <stdint.h>
 
 #define PTE_MASK (1023U << 12)
 #define PDE_MASK (1023U << 22)
-#define EMERGENCY_DIR \
-        ((struct i686_vm_pd *)((I686VM_PD_RECURSIVE_NDX << 22) | (I686VM_PD_EMERGENCY_NDX << 12)))
+
+/* Above this number of pages, reloading CR3 is cheaper than invalidating every page. */
+#define TLB_INVLPG_MAX (32U)
 
 void vm_arch_iter_reserved_vaddresses(void (*fn)(void const *addr, size_t len, void *data),
                                       void *data)
 {
         /* Reserved PD entries. */
         fn(I686VM_PD_RECURSIVE_ADDR, PLATFORM_PAGE_SIZE, data);
-        fn(I686VM_PD_EMERGENCY_ADDR, PLATFORM_PAGE_SIZE, data);
+        fn(I686VM_PD_KMAP_ADDR, PLATFORM_PAGE_SIZE, data);
 }
 
 bool vm_arch_is_range_valid(void const *base, size_t len)
@@ -52,11 +54,67 @@ void *vm_arch_get_early_pgroot(void)
         return (&boot_paging_pd);
 }
 
+static bool PAT_ENABLED = false;
+
+/* With PAT, entries 0-3 keep their power-up values, so PWT/PCD work as they did without it. */
+#define PAT_MSR        (0x277U)
+#define PAT_TYPE_WC    (0x01ULL)
+#define PAT_ENTRY_WC   (4U)
+#define CPUID_EDX_PAT  (0x1U << 16)
+
+static void cpuid(uint32_t leaf, uint32_t *eax, uint32_t *ebx, uint32_t *ecx, uint32_t *edx)
+{
+        asm volatile("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+static uint64_t rdmsr(uint32_t msr)
+{
+        uint32_t lo, hi;
+        asm volatile("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+        return (((uint64_t)hi << 32) | lo);
+}
+
+static void wrmsr(uint32_t msr, uint64_t value)
+{
+        asm volatile("wrmsr" ::"c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+void i686_vm_setup_pat(void)
+{
+        uint32_t eax, ebx, ecx, edx;
+        cpuid(0x1, &eax, &ebx, &ecx, &edx);
+        if (!(edx & CPUID_EDX_PAT)) {
+                LOGF_W("The CPU doesn't support PAT. Write-Combining mappings will be uncached.\n");
+                return;
+        }
+
+        uint64_t pat = rdmsr(PAT_MSR);
+        pat &= ~(0xFFULL << (PAT_ENTRY_WC * 8));
+        pat |= PAT_TYPE_WC << (PAT_ENTRY_WC * 8);
+
+        /* The caches and the TLB may hold lines of the old memory types. */
+        asm volatile("wbinvd" ::: "memory");
+        wrmsr(PAT_MSR, pat);
+        asm volatile("wbinvd" ::: "memory");
+        i686_vm_tlb_flush();
+
+        PAT_ENABLED = true;
+}
+
 enum i686_vm_table_flags i686_vm_to_table_flags(enum vm_flags area_flags)
 {
         enum i686_vm_table_flags f = 0;
         f |= area_flags & VM_WRITE ? I686VM_TABLE_FLAG_RW : 0;
         f |= area_flags & VM_USER ? I686VM_TABLE_FLAG_USER : 0;
+
+        enum i686_vm_table_flags const uncached =
+                I686VM_TABLE_FLAG_CACHE_OFF | I686VM_TABLE_FLAG_CACHE_WT;
+        if (area_flags & VM_WRITE_COMBINE) {
+                /* PAT index 4: PAT=1, PCD=0, PWT=0. */
+                f |= PAT_ENABLED ? I686VM_TABLE_FLAG_PAT : uncached;
+        } else if (area_flags & VM_CACHE_OFF) {
+                f |= uncached;
+        }
         return (f);
 }
 
@@ -102,8 +160,9 @@ struct i686_vm_pge *i686_vm_get_pge(enum i686_vm_pg_lvls lvl, struct i686_vm_pd
 void i686_vm_tlb_flush(void)
 {
         barrier_compiler();
-        asm volatile("movl %cr0, %eax;"
-                     "movl %eax, %cr0");
+        asm volatile("movl %%cr3, %%eax;"
+                     "movl %%eax, %%cr3" ::
+                             : "eax", "memory");
         barrier_compiler();
 }
 
@@ -147,53 +206,193 @@ void i686_vm_setup_recursive_mapping(struct i686_vm_pd *dir_actual, void *dir_pa
         e->dir.flags |= I686VM_DIR_FLAG_RW;
 }
 
-/* Access to the PGE will be performed through the emergency entry.
- * As such, when you're done, you MUST call the free_emergency_entry() function.
- * Also, create_new_dir() uses emergency entry too, so...
- * TODO: Add locks to the emergency page directory entry. */
-static struct i686_vm_pge *get_pge_for_vaddr(void *tree_root, void const *vaddr)
+void i686_vm_setup_kmap(struct i686_vm_pd *dir, void *table_paddr)
 {
-        struct i686_vm_pd *root_dir = tree_root;
-        struct i686_vm_pge *emergency = &root_dir->emergency;
+        struct i686_vm_pge *e = &dir->kmap;
+        kassert(!e->any.is_present);
+
+        i686_vm_pge_set_addr(e, table_paddr);
+        e->any.is_present = true;
+        e->dir.flags |= I686VM_DIR_FLAG_RW;
+}
 
-        kassert(!emergency->any.is_present);
+/* Each CPU owns CONF_KMAP_SLOTS consecutive entries of the kmap table. */
+kstatic_assert(CONF_MAX_CPUS * CONF_KMAP_SLOTS <= I686VM_PD_LAST_VALID_PAGE + 1,
+               "The kmap window can't fit all of the slots.");
 
-        struct i686_vm_pge *pge_root = i686_vm_get_pge(I686VM_PGLVL_DIR, root_dir, vaddr);
-        i686_vm_pge_set_addr(emergency, i686_vm_pge_get_addr(pge_root));
-        emergency->any.is_present = true;
-        emergency->dir.flags |= I686VM_DIR_FLAG_RW;
+static size_t KMAP_DEPTH[CONF_MAX_CPUS];
+
+static struct i686_vm_pd *kmap_table(void)
+{
+        return ((struct i686_vm_pd *)&boot_paging_kmap);
+}
+
+static void *kmap_slot_addr(size_t slot)
+{
+        return ((void *)((uintptr_t)I686VM_PD_KMAP_ADDR + slot * PLATFORM_PAGE_SIZE));
+}
+
+void vm_arch_write_protect_enable(void)
+{
+        /* The only read-only pages are the kernel's text and rodata, and the heap zero page.
+         * Paging structures, kmap slots, and the rest of the kernel are mapped writable. */
+        i686_vm_write_protect_enable();
+}
+
+void *vm_arch_kmap(phys_addr_t frame)
+{
+        kassert(check_align((uintptr_t)frame, PLATFORM_PAGE_SIZE));
 
+        unsigned const cpu = kernel_arch_get_cpu_id();
+        kassert(cpu < CONF_MAX_CPUS);
+
+        size_t *depth = &KMAP_DEPTH[cpu];
+        if (__unlikely(*depth >= CONF_KMAP_SLOTS)) {
+                LOGF_P("Ran out of kmap slots on CPU %u.\n", cpu);
+        }
+
+        size_t const slot = cpu * CONF_KMAP_SLOTS + *depth;
+        (*depth)++;
+
+        void *const vaddr = kmap_slot_addr(slot);
+        struct i686_vm_pge *pte = &kmap_table()->entries[slot];
+
+        /* Released slots are unmapped, so there is nothing stale in the TLB. */
+        kassert(!pte->any.is_present);
+        i686_vm_pge_set_addr(pte, frame);
+        pte->table.flags = I686VM_TABLE_FLAG_RW;
+        pte->any.is_present = true;
         barrier_compiler();
-        struct i686_vm_pge *pge_table = i686_vm_get_pge(I686VM_PGLVL_TABLE, EMERGENCY_DIR, vaddr);
 
-        return (pge_table);
+        return (vaddr);
 }
 
-static void free_emergency_entry(void *tree_root)
+void vm_arch_kunmap(void *vaddr)
 {
-        struct i686_vm_pd *root_dir = tree_root;
-        struct i686_vm_pge *emergency = &root_dir->emergency;
+        unsigned const cpu = kernel_arch_get_cpu_id();
+        kassert(cpu < CONF_MAX_CPUS);
+
+        size_t *depth = &KMAP_DEPTH[cpu];
+        kassert(*depth > 0);
+        (*depth)--;
+
+        size_t const slot = cpu * CONF_KMAP_SLOTS + *depth;
+        /* Catch unbalanced kmap/kunmap pairs. */
+        kassert(vaddr == kmap_slot_addr(slot));
+        barrier_compiler();
+
+        /* The frame may be freed right after, so it mustn't stay accessible through the slot. */
+        kmap_table()->entries[slot] = (struct i686_vm_pge){ 0 };
+        i686_vm_tlb_invlpg(vaddr);
+}
 
-        kassert(emergency->any.is_present);
+/* The directory that is loaded into CR3.
+ * There are no address spaces other than the kernel's one, so it never changes. */
+static struct i686_vm_pd *ACTIVE_DIR = (struct i686_vm_pd *)&boot_paging_pd;
+
+/* Tables of the active directory are visible through the recursive slot.
+ * The table of the N-th directory entry is the N-th page of the slot. */
+static struct i686_vm_pd *recursive_table(void const *vaddr)
+{
+        uintptr_t const addr = (uintptr_t)I686VM_PD_RECURSIVE_ADDR +
+                               get_pde_ndx(vaddr) * PLATFORM_PAGE_SIZE;
+        return ((struct i686_vm_pd *)addr);
+}
 
-        emergency->any.is_present = false;
-        i686_vm_tlb_invlpg(EMERGENCY_DIR);
+static bool is_recursive_addr(void const *addr)
+{
+        return ((uintptr_t)addr >= (uintptr_t)I686VM_PD_RECURSIVE_ADDR);
+}
+
+/* A table of another space is accessed through a kmap slot.
+ * As such, when you're done, you MUST call the put_table() function. */
+static struct i686_vm_pd *get_table(struct i686_vm_pd *root_dir, void const *vaddr)
+{
+        if (root_dir == ACTIVE_DIR) {
+                return (recursive_table(vaddr));
+        }
+
+        struct i686_vm_pge *pge_root = i686_vm_get_pge(I686VM_PGLVL_DIR, root_dir, vaddr);
+        return (vm_arch_kmap(i686_vm_pge_get_addr(pge_root)));
+}
+
+static void put_table(struct i686_vm_pd *table)
+{
+        if (!is_recursive_addr(table)) {
+                vm_arch_kunmap(table);
+        }
+}
+
+/* When you're done, you MUST call the put_pge() function. */
+static struct i686_vm_pge *get_pge_for_vaddr(void *tree_root, void const *vaddr)
+{
+        struct i686_vm_pd *table = get_table(tree_root, vaddr);
+        return (i686_vm_get_pge(I686VM_PGLVL_TABLE, table, vaddr));
+}
+
+static void put_pge(struct i686_vm_pge *pge)
+{
+        put_table(align_rounddownptr(pge, PLATFORM_PAGE_SIZE));
 }
 
 void *vm_arch_resolve_phys_page(void *tree_root, void const *virt_page)
 {
+        struct i686_vm_pge *pde = i686_vm_get_pge(I686VM_PGLVL_DIR, tree_root, virt_page);
+        if (!pde->any.is_present) {
+                return (NULL);
+        }
+
         struct i686_vm_pge *e = get_pge_for_vaddr(tree_root, virt_page);
 
-        void *phys_addr = i686_vm_pge_get_addr(e);
+        void *phys_addr = e->any.is_present ? i686_vm_pge_get_addr(e) : NULL;
 
-        free_emergency_entry(tree_root);
+        put_pge(e);
 
         return (phys_addr);
 }
 
-void i686_vm_pg_fault_handler(struct intr_ctx *ctx __unused)
+bool vm_arch_pt_test_and_clear_accessed(void *tree_root, void *virt_page)
+{
+        struct i686_vm_pge *pde = i686_vm_get_pge(I686VM_PGLVL_DIR, tree_root, virt_page);
+        if (!pde->any.is_present) {
+                return (false);
+        }
+
+        struct i686_vm_pge *e = get_pge_for_vaddr(tree_root, virt_page);
+
+        bool const accessed = e->table.is_present && (e->table.flags & I686VM_TABLE_FLAG_ACCESSED);
+        if (accessed) {
+                /* The bit is known to be set. */
+                e->table.flags ^= I686VM_TABLE_FLAG_ACCESSED;
+                /* The CPU doesn't set the bit again while the entry is cached. */
+                if (tree_root == ACTIVE_DIR) {
+                        i686_vm_tlb_invlpg(virt_page);
+                }
+        }
+
+        put_pge(e);
+
+        return (accessed);
+}
+
+/* Bits of the error code pushed by the CPU on a page fault. */
+#define PGFAULT_ERR_PRESENT (0x1 << 0)
+#define PGFAULT_ERR_WRITE   (0x1 << 1)
+#define PGFAULT_ERR_USER    (0x1 << 2)
+
+static enum vm_fault_flags to_fault_flags(uint32_t err_code)
+{
+        enum vm_fault_flags f = 0;
+        f |= err_code & PGFAULT_ERR_PRESENT ? VM_FAULT_PRESENT : 0;
+        f |= err_code & PGFAULT_ERR_WRITE ? VM_FAULT_WRITE : 0;
+        f |= err_code & PGFAULT_ERR_USER ? VM_FAULT_USER : 0;
+        return (f);
+}
+
+void i686_vm_pg_fault_handler(struct intr_ctx *ctx)
 {
         void *const fault_at = i686_vm_get_cr2();
+        enum vm_fault_flags const fault = to_fault_flags(ctx->err_code);
         struct vm_space *fault_space = NULL;
         if (addr_is_high(fault_at)) {
                 fault_space = &CURRENT_KERNEL;
@@ -202,45 +401,85 @@ void i686_vm_pg_fault_handler(struct intr_ctx *ctx __unused)
                 fault_space = CURRENT_USER;
         }
 
-        struct rbtree_node *rbtnode =
-                rbtree_search(&fault_space->rb_areas, fault_at, vm_area_rbtcmpfn_area_to_addr);
-
-        if (rbtnode == NULL) {
+        struct vm_area *fault_area = vm_space_find_area(fault_space, fault_at);
+        if (fault_area == NULL) {
                 LOGF_P("Page fault at the address (%p) not covered by any vm_area!\n", fault_at);
         }
 
-        struct vm_area *fault_area = rbtnode->data;
-
         if (__likely(fault_area->ops.handle_pg_fault != NULL)) {
-                fault_area->ops.handle_pg_fault(fault_area, fault_at);
+                fault_area->ops.handle_pg_fault(fault_area, fault_at, fault);
         } else {
                 LOGF_P("Unhandled page fault at %p!\n", fault_at);
         }
 }
 
-static void *create_new_dir(struct i686_vm_pd *root_pd)
+static struct mm_page *PT_POOL[CONF_VM_PT_POOL_SIZE];
+static size_t PT_POOL_COUNT = 0;
+
+static struct mm_page *alloc_zeroed_frame(void)
 {
         struct mm_page *page = mm_alloc_page();
         if (__unlikely(NULL == page)) {
-                LOGF_P("Couldn't allocate new frame for PD.\n");
+                return (NULL);
         }
 
-        struct i686_vm_pge *e = &root_pd->emergency;
-        kassert(!e->any.is_present);
+        void *table = vm_arch_kmap(page->paddr);
+        kmemset(table, 0x0, PLATFORM_PAGE_SIZE);
+        vm_arch_kunmap(table);
 
-        i686_vm_pge_set_addr(e, page->paddr);
-        e->any.is_present = true;
-        e->dir.flags |= I686VM_DIR_FLAG_RW;
+        return (page);
+}
 
+/* Faults take tables from the pool, and the pool is refilled once they're over. */
+static struct deferred_work PT_POOL_WORK = {
+        .name = "pt_pool_refill",
+        .fn = vm_arch_pt_pool_refill,
+};
 
-        barrier_compiler();
+void vm_arch_pt_pool_refill(void)
+{
+        deferred_register(&PT_POOL_WORK);
 
-        kmemset(EMERGENCY_DIR, 0x0, PLATFORM_PAGE_SIZE);
+        while (PT_POOL_COUNT < CONF_VM_PT_POOL_SIZE) {
+                struct mm_page *page = alloc_zeroed_frame();
+                if (NULL == page) {
+                        /* The faults will have to try on their own. */
+                        return;
+                }
+
+                PT_POOL[PT_POOL_COUNT++] = page;
+        }
+}
+
+static struct mm_page *create_new_dir(void)
+{
+        struct mm_page *page = NULL;
+        deferred_schedule(&PT_POOL_WORK);
+        if (__likely(PT_POOL_COUNT > 0)) {
+                page = PT_POOL[--PT_POOL_COUNT];
+        } else {
+                page = alloc_zeroed_frame();
+        }
+
+        if (__unlikely(NULL == page)) {
+                LOGF_P("Couldn't allocate new frame for PD.\n");
+        }
+
+        page->pt_used = 0;
+
+        return (page);
+}
 
-        e->any.is_present = false;
-        i686_vm_tlb_invlpg(EMERGENCY_DIR);
+/* Tables set up during the boot live in the kernel image and aren't counted. */
+static struct mm_page *get_table_page(struct i686_vm_pge *pde)
+{
+        if (!(pde->dir.kernel_data & I686VM_DIR_KDATA_RECLAIMABLE)) {
+                return (NULL);
+        }
 
-        return (page->paddr);
+        struct mm_page *page = mm_get_page_by_paddr(i686_vm_pge_get_addr(pde));
+        kassert(page != NULL);
+        return (page);
 }
 
 void vm_arch_pt_map(void *tree_root, const void *phys_addr, const void *at_virt_addr,
@@ -250,9 +489,12 @@ void vm_arch_pt_map(void *tree_root, const void *phys_addr, const void *at_virt_
 
         struct i686_vm_pge *pde = i686_vm_get_pge(I686VM_PGLVL_DIR, tree_root, at_virt_addr);
         if (!pde->any.is_present) {
-                void *new_pd_paddr = create_new_dir(tree_root);
-                i686_vm_pge_set_addr(pde, new_pd_paddr);
-                pde->dir.flags = i686_vm_to_dir_flags(flags);
+                struct mm_page *new_pd = create_new_dir();
+                i686_vm_pge_set_addr(pde, new_pd->paddr);
+                /* The directory entry may cover pages with different access rights.
+                 * Let the table entries enforce them. */
+                pde->dir.flags = i686_vm_to_dir_flags(flags | VM_WRITE);
+                pde->dir.kernel_data = I686VM_DIR_KDATA_RECLAIMABLE;
                 pde->dir.is_present = true;
         }
 
@@ -263,16 +505,104 @@ void vm_arch_pt_map(void *tree_root, const void *phys_addr, const void *at_virt_
         pte->table.flags = i686_vm_to_table_flags(flags);
         pte->any.is_present = true;
 
-        free_emergency_entry(tree_root);
+        put_pge(pte);
+
+        struct mm_page *table_page = get_table_page(pde);
+        if (table_page != NULL) {
+                kassert(table_page->pt_used < I686VM_PT_ENTRIES);
+                table_page->pt_used++;
+        }
 }
 
-void vm_arch_pt_unmap(void *tree_root, void *virt_addr)
+void vm_arch_pt_remap(void *tree_root, const void *phys_addr, void *at_virt_addr,
+                      enum vm_flags flags)
 {
-        struct i686_vm_pge *pte = get_pge_for_vaddr(tree_root, virt_addr);
+        kassert(tree_root != NULL);
+
+        struct i686_vm_pge *pde = i686_vm_get_pge(I686VM_PGLVL_DIR, tree_root, at_virt_addr);
+        kassert(pde->any.is_present);
+
+        /* The entry stays present, so the table keeps its use count. */
+        struct i686_vm_pge *pte = get_pge_for_vaddr(tree_root, at_virt_addr);
         kassert(pte->any.is_present);
 
-        pte->any.is_present = false;
-        i686_vm_tlb_invlpg(virt_addr);
+        i686_vm_pge_set_addr(pte, phys_addr);
+        pte->table.flags = i686_vm_to_table_flags(flags);
+
+        put_pge(pte);
+
+        if (tree_root == ACTIVE_DIR) {
+                i686_vm_tlb_invlpg(at_virt_addr);
+        }
+}
+
+/**
+ * @brief Unmap pages starting at the address, but not past the end of its Page Table.
+ * @return The number of unmapped pages.
+ */
+static size_t unmap_within_table(struct i686_vm_pd *root_dir, void *virt_addr, size_t pages)
+{
+        struct i686_vm_pge *pde = i686_vm_get_pge(I686VM_PGLVL_DIR, root_dir, virt_addr);
+        kassert(pde->any.is_present);
+
+        size_t const count = MIN(pages, I686VM_PT_ENTRIES - get_pte_ndx(virt_addr));
+
+        struct i686_vm_pd *table = get_table(root_dir, virt_addr);
+        for (size_t i = 0; i < count; i++) {
+                void *page = (void *)((uintptr_t)virt_addr + i * PLATFORM_PAGE_SIZE);
+                struct i686_vm_pge *pte = i686_vm_get_pge(I686VM_PGLVL_TABLE, table, page);
+                kassert(pte->any.is_present);
 
-        free_emergency_entry(tree_root);
+                pte->any.is_present = false;
+        }
+        put_table(table);
+
+        struct mm_page *table_page = get_table_page(pde);
+        bool free_table = false;
+        if (table_page != NULL) {
+                kassert(table_page->pt_used >= count);
+                table_page->pt_used = (uint16_t)(table_page->pt_used - count);
+                free_table = table_page->pt_used == 0;
+        }
+
+        if (free_table) {
+                *pde = (struct i686_vm_pge){ 0 };
+        }
+
+        /* Invalidating any page of the range also evicts the directory entry from
+         * the paging-structure caches, so the table can be freed afterwards. */
+        if (count > TLB_INVLPG_MAX) {
+                i686_vm_tlb_flush();
+        } else {
+                for (size_t i = 0; i < count; i++) {
+                        i686_vm_tlb_invlpg((void *)((uintptr_t)virt_addr + i * PLATFORM_PAGE_SIZE));
+                }
+
+                /* The table must disappear from the recursive slot as well. */
+                if (free_table && root_dir == ACTIVE_DIR) {
+                        i686_vm_tlb_invlpg(recursive_table(virt_addr));
+                }
+        }
+
+        if (free_table) {
+                mm_free_page(table_page->paddr);
+        }
+
+        return (count);
+}
+
+void vm_arch_pt_unmap(void *tree_root, void *virt_addr)
+{
+        unmap_within_table(tree_root, virt_addr, 1);
+}
+
+void vm_arch_pt_unmap_range(void *tree_root, void *virt_addr, size_t pages)
+{
+        kassert(check_align((uintptr_t)virt_addr, PLATFORM_PAGE_SIZE));
+
+        while (pages > 0) {
+                size_t const done = unmap_within_table(tree_root, virt_addr, pages);
+                virt_addr = (void *)((uintptr_t)virt_addr + done * PLATFORM_PAGE_SIZE);
+                pages -= done;
+        }
 }
@@ -0,0 +1,24 @@
+#ifndef _KERNEL_BLKDEV_H
+#define _KERNEL_BLKDEV_H
+
+#include <stddef.h>
+
+/**
+ * A device that is read and written by blocks.
+ */
+struct blkdev {
+        const char *name;
+        size_t block_size;
+        size_t blocks_count;
+#define BLKDEV_RC_OK   (0x0)
+#define BLKDEV_RC_FAIL (-0x1)
+        int (*read)(struct blkdev *dev, size_t block, void *buf);
+        int (*write)(struct blkdev *dev, size_t block, void const *buf);
+        /**
+         * @brief Tell the device that the data of the block isn't needed anymore. May be NULL.
+         */
+        void (*discard)(struct blkdev *dev, size_t block);
+        void *data;
+};
+
+#endif /* _KERNEL_BLKDEV_H */
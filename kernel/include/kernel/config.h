@@ -6,16 +6,35 @@
 #endif /* __ASSEMBLER__ */
 
 #define CONF_STACK_SIZE         (16 << 10)
+#define CONF_KSTACK_CACHE_SIZE  (4)
+#define CONF_MAX_CPUS           (1)
+#define CONF_KMAP_SLOTS         (4)
 #define CONF_TIMER_QUEUE_LENGTH (100)
+#define CONF_TIMER_TICK_MS      (10)
 #define CONF_STATIC_SLAB_SPACE  (16384)
 #define CONF_MALLOC_MIN_POW     (5)
 #define CONF_MALLOC_MAX_POW     (11)
+#define CONF_KMM_MAGAZINE_SIZE  (15)
 
-#define CONF_HEAP_MAX_CHUNK_SIZE ((size_t)32 * 1024 * 1024)
-#define CONF_DEV_MAX_AREA_SIZE   ((size_t)32 * 1024 * 1024)
+#define CONF_KMM_REAP_INTERVAL_MS (2000)
+#define CONF_KMM_REAP_AGE         (3) /**< Reap intervals an idle slab or magazine is kept for. */
+#define CONF_KMM_REAP_BATCH       (8) /**< Slabs released by one reap at most. */
+
+#define CONF_MM_LOW_WATERMARK_PAGES    (256)
+#define CONF_HEAP_MAX_CHUNK_SIZE       ((size_t)32 * 1024 * 1024)
+#define CONF_HEAP_LOW_WATERMARK_PAGES  (16)
+#define CONF_HEAP_HIGH_WATERMARK_PAGES (1024)
+#define CONF_HEAP_RESERVED_CHUNKS      (2)
+#define CONF_HEAP_SHRINK_INTERVAL_MS   (2000)
+#define CONF_HEAP_CHUNK_IDLE_AGE       (3) /**< Shrink intervals an empty chunk is kept for. */
+#define CONF_ZSTORE_MAX_SIZE           (1536)
+#define CONF_ZSTORE_RESERVED_ENTRIES   (8) /**< Per size class. */
+#define CONF_SWAP_RESERVED_ENTRIES     (16)
+#define CONF_DEV_MAX_AREA_SIZE         ((size_t)32 * 1024 * 1024)
 
 #define CONF_VM_RECURSIVE_PAGE (PLATFORM_PAGEDIR_PAGES - 1 - 1)
 #define CONF_VM_ERRORS_PAGE    (PLATFORM_PAGEDIR_PAGES - 1)
 #define CONF_VM_AVAILABLE_PAGES (1022)
+#define CONF_VM_PT_POOL_SIZE    (8)
 
 #endif /* _KERNEL_CONFIG_H */
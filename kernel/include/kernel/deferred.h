@@ -0,0 +1,40 @@
+#ifndef _KERNEL_DEFERRED_H
+#define _KERNEL_DEFERRED_H
+
+#include "lib/ds/slist.h"
+
+#include <stdbool.h>
+
+/**
+ * Work that can't be done where the need for it is noticed (e.g. in an interrupt handler or
+ * in the middle of an allocation), so it waits for a point where nothing is half-updated.
+ */
+struct deferred_work {
+        const char *name;
+        void (*fn)(void);
+        bool pending;
+
+        struct slist_ref list;
+};
+
+/**
+ * @brief Register the work. Must not be called from interrupt handlers.
+ */
+void deferred_register(struct deferred_work *w);
+
+/**
+ * @brief Ask for the work to be done on the next deferred_run().
+ *
+ * It's safe to call from an interrupt handler and from inside of any subsystem.
+ */
+void deferred_schedule(struct deferred_work *w);
+
+/**
+ * @brief Do the pending work.
+ *
+ * Must be called where no subsystem is in the middle of an update, and never from interrupt
+ * handlers.
+ */
+void deferred_run(void);
+
+#endif /* _KERNEL_DEFERRED_H */
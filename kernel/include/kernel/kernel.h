@@ -6,6 +6,8 @@
 
 #include "lib/cppdefs.h"
 
+#include <stdbool.h>
+
 enum kernel_segments {
         KSEGMENT_TEXT,
         KSEGMENT_RODATA,
@@ -18,6 +20,24 @@ extern struct vm_area KERNELBIN_AREAS[KSEGMENT_COUNT];
 
 void kernel_arch_get_segment(enum kernel_segments seg, void **start, void **end);
 
+/**
+ * @brief Get the index of the CPU that executes the caller.
+ */
+unsigned kernel_arch_get_cpu_id(void);
+
+/**
+ * @brief Call the function on the given stack. The current stack is abandoned.
+ */
+__noreturn void kernel_arch_switch_stack(void *stack_top, void (*fn)(void));
+
+/**
+ * @brief Disable the interrupts on the current CPU.
+ * @return Whether they were enabled. Pass it to kernel_arch_irq_restore().
+ */
+bool kernel_arch_irq_save(void);
+
+void kernel_arch_irq_restore(bool enabled);
+
 /* TODO: This two belong to process context. */
 extern struct vm_space CURRENT_KERNEL;
 extern struct vm_space *CURRENT_USER;
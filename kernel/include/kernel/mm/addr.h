@@ -11,6 +11,13 @@ typedef void *phys_addr_t;
 /* Represents a virtual address. */
 typedef void *virt_addr_t;
 
+/* Describes the access that caused a page fault. */
+enum vm_fault_flags {
+        VM_FAULT_WRITE = 0x1 << 0,
+        VM_FAULT_USER = 0x1 << 1,
+        VM_FAULT_PRESENT = 0x1 << 2, /**< The page is mapped, but the access is not allowed. */
+};
+
 /**
  * @brief Set's an offset where the "high memory" starts.
  * @note Must be set at the beginning of the boot process. But only after the early paging.
@@ -44,6 +51,7 @@ struct vm_area;
 /**
  * @brief Maps a physical page that is a direct counterpart to a virtual page from the high memory.
  */
-void addr_pgfault_handler_maplow(struct vm_area *area, virt_addr_t addr);
+void addr_pgfault_handler_maplow(struct vm_area *area, virt_addr_t addr,
+                                 enum vm_fault_flags fault);
 
 #endif /* _KERNEL_MM_ADDR_H */
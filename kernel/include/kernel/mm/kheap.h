@@ -5,8 +5,37 @@
 
 void kheap_init(struct vm_space *space);
 
+/**
+ * @brief Preallocate what the heap needs to grow when the memory is tight.
+ *
+ * Must be called once the slab allocator is up.
+ */
+void kheap_reserve_refill(void);
+
 void *kheap_alloc_page(void);
 
 void kheap_free_page(void *page);
 
+/**
+ * @brief Start the next shrink interval. It's safe to call from an interrupt handler.
+ *
+ * Chunks that have stayed empty for CONF_HEAP_CHUNK_IDLE_AGE intervals are released on the next
+ * deferred_run() or free, so an idle heap gives its memory back too.
+ */
+void kheap_shrink_tick(void);
+
+/**
+ * @brief Allocate n virtually contiguous pages.
+ *
+ * The pages are backed by frames that aren't contiguous and are mapped on the first access.
+ * @return The first page or NULL.
+ */
+void *kheap_alloc_pages(size_t n);
+
+/**
+ * @brief Free pages allocated by kheap_alloc_pages().
+ * @param n The number of pages that was requested.
+ */
+void kheap_free_pages(void *pages, size_t n);
+
 #endif /* _KERNEL_MM_KHEAP_H */
@@ -1,10 +1,12 @@
 #ifndef _KERNEL_MM_KMM_H
 #define _KERNEL_MM_KMM_H
 
+#include "kernel/config.h"
 #include "kernel/mm/vm.h"
 
 #include "lib/ds/slist.h"
 #include "lib/cppdefs.h"
+#include "lib/sync/spinlock.h"
 
 #include <stdbool.h>
 #include <stddef.h>
@@ -13,6 +15,25 @@
 typedef void *(*alloc_page_fn_t)(void);
 typedef void (*free_page_fn_t)(void *);
 
+struct kmm_magazine;
+
+/**
+ * Objects a CPU has freed recently. Alloc and free take them without touching slabs.
+ */
+struct kmm_cpu_cache {
+        struct kmm_magazine *loaded;
+        struct kmm_magazine *previous;
+};
+
+struct kmm_cache_stats {
+        size_t allocs;         /**< Objects handed out. */
+        size_t frees;          /**< Objects given back. */
+        size_t grows;          /**< Slabs created. */
+        size_t shrinks;        /**< Slabs destroyed. */
+        size_t active_objects; /**< Objects in use by the clients of the cache. */
+        size_t active_slabs;   /**< Slabs owned by the cache. */
+};
+
 struct kmm_cache {
         size_t size;          /**< Size of objects in the cache. */
         size_t alignment;     /**< Alignment of each object. */
@@ -24,7 +45,10 @@ struct kmm_cache {
         size_t colour_off;
         size_t colour_next;
 
-#define KMM_CACHE_LARGE (0x1 << 0)
+#define KMM_CACHE_LARGE       (0x1 << 0)
+#define KMM_CACHE_NO_MAGAZINE (0x1 << 1) /**< Objects always come right from the slabs. */
+#define KMM_CACHE_LAZY_CTOR   (0x1 << 2) /**< Construct objects on their first allocation. */
+#define KMM_CACHE_MERGEABLE   (0x1 << 3) /**< May share slabs with caches of the same geometry. */
         unsigned flags;
 
         const char *name;
@@ -35,6 +59,22 @@ struct kmm_cache {
         struct slist_ref slabs_partial;
         struct slist_ref slabs_full;
 
+        struct kmm_cpu_cache cpus[CONF_MAX_CPUS];
+        /* Magazines that no CPU holds. */
+        struct spinlock depot_lock;
+        struct slist_ref depot_full;
+        struct slist_ref depot_empty;
+
+        struct kmm_cache_stats stats;
+
+        /* Nonzero while an operation on the cache is in progress. Its slabs may be inconsistent
+         * then, so reclaim, which may run from within the operation, leaves the cache alone. */
+        unsigned busy;
+
+        /* Merged caches keep only their statistics. Objects come from the shared cache. */
+        struct kmm_cache *merged_into;
+        size_t merged_users; /**< Number of caches merged into this one. */
+
         struct slist_ref sys_caches; /**< List of all created caches. Used to reclaim memory. */
 };
 
@@ -44,10 +84,58 @@ struct kmm_cache {
 void kmm_init(alloc_page_fn_t alloc_page_fn, free_page_fn_t free_page_fn);
 void kmm_cache_trim_all(void);
 
+/**
+ * @brief Start the next reap interval. It's safe to call from an interrupt handler.
+ *
+ * The reap itself is deferred to the next deferred_run(), unless some cache grows earlier.
+ */
+void kmm_reap_tick(void);
+
+/**
+ * @brief Release the slabs that have stayed empty for CONF_KMM_REAP_AGE reap intervals.
+ *
+ * Depot magazines that have stayed unused as long are flushed first, so the slabs of an idle
+ * cache become empty even though its objects were cached.
+ * At most CONF_KMM_REAP_BATCH slabs are released at once, so idle caches give their pages back
+ * gradually, while the caches that keep using their slabs don't lose them.
+ *
+ * @return Number of released slabs.
+ */
+size_t kmm_reap(void);
+
+/**
+ * @brief Initialize a cache in place and register it.
+ *
+ * Registered caches are reaped, shrunk, and shown by kmm_dump_stats(). It may be called before
+ * kmm_init(), but the cache must not be used until then.
+ *
+ * A KMM_CACHE_MERGEABLE cache without ctor and dtor shares the slabs with other mergeable
+ * caches that have the same stride, alignment, and flags. Caches initialized before kmm_init()
+ * are merged by it.
+ */
 void kmm_cache_init(struct kmm_cache *restrict cache, const char *name, size_t size, size_t align,
                     unsigned flags, void (*ctor)(void *), void (*dtor)(void *));
+/**
+ * @brief Give the memory of unused objects back.
+ *
+ * Objects cached by the calling CPU and by the depot are returned to slabs,
+ * and the slabs that become empty are freed.
+ */
 void kmm_cache_trim(struct kmm_cache *cache);
 
+/**
+ * @brief Bytes of the slab pages that can't hold any object.
+ *
+ * The slab headers and the padding of objects to the stride are accounted for and aren't
+ * counted.
+ */
+size_t kmm_cache_wasted(struct kmm_cache const *cache);
+
+/**
+ * @brief Print statistics of every cache.
+ */
+void kmm_dump_stats(void);
+
 /**
  * @brief Allocates, inits, and registers new cache object.
  *
@@ -58,6 +146,8 @@ void kmm_cache_trim(struct kmm_cache *cache);
  * @param ctor Method to call on each object's creation.
  * @param dtor Method to call on each object's deletion.
  * @return Pointer on a newly created cache.
+ *
+ * Mergeable caches are merged as by kmm_cache_init().
  */
 struct kmm_cache *kmm_cache_create(const char *name, size_t size, size_t align,
                                    unsigned cache_flags, void (*ctor)(void *),
@@ -82,4 +172,23 @@ __malloc void *kmm_cache_alloc(struct kmm_cache *);
  */
 void kmm_cache_free(struct kmm_cache *, void *mem);
 
+/**
+ * @brief Get n objects from a cache at once.
+ *
+ * Whole slab freelists are taken in one pass,
+ * which is cheaper than calling kmm_cache_alloc() n times.
+ *
+ * @param out Array to store the objects in.
+ * @return false if there is not enough memory. Nothing is allocated in that case.
+ */
+bool kmm_cache_alloc_bulk(struct kmm_cache *, size_t n, void **out);
+
+/**
+ * @brief Free n objects at once.
+ *
+ * The objects go straight back to their slabs.
+ * Objects from the same slab should be next to each other.
+ */
+void kmm_cache_free_bulk(struct kmm_cache *, size_t n, void **objs);
+
 #endif /* _KERNEL_MM_KMM_H */
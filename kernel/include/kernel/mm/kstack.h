@@ -0,0 +1,29 @@
+#ifndef _KERNEL_MM_KSTACK_H
+#define _KERNEL_MM_KSTACK_H
+
+#include "kernel/mm/vm_space.h"
+
+#include <stdbool.h>
+
+void kstack_init(struct vm_space *space);
+
+/**
+ * @brief Allocate a kernel stack of CONF_STACK_SIZE bytes.
+ *
+ * Every stack is a separate area with an unmapped guard page right below it,
+ * so an overflow faults instead of corrupting the neighbours.
+ * @return The top of the stack (the initial stack pointer) or NULL.
+ */
+void *kstack_alloc(void);
+
+/**
+ * @brief Free the stack returned by kstack_alloc().
+ */
+void kstack_free(void *top);
+
+/**
+ * @brief Check whether the address lies in the guard page of a kernel stack.
+ */
+bool kstack_is_guard(void const *addr);
+
+#endif /* _KERNEL_MM_KSTACK_H */
@@ -0,0 +1,32 @@
+#ifndef _KERNEL_MM_LRU_H
+#define _KERNEL_MM_LRU_H
+
+#include "kernel/mm/mm.h"
+#include "kernel/mm/vm_area.h"
+
+#include <stddef.h>
+
+/*
+ * Reclaimable pages age on two lists.
+ * New and recently accessed pages are active. Pages that haven't been accessed for a while
+ * are moved to the inactive list, and those are swapped out under memory pressure.
+ * The accessed bits of the page tables tell whether a page has been used.
+ */
+
+void lru_init(void);
+
+/**
+ * @brief Make the page reclaimable.
+ * @param vaddr The only mapping of the page. The page must be mapped.
+ */
+void lru_add(struct mm_page *page, struct vm_area *area, void *vaddr);
+
+void lru_remove(struct mm_page *page);
+
+/**
+ * @brief Swap out up to nr pages.
+ * @return The number of freed frames.
+ */
+size_t lru_reclaim(size_t nr);
+
+#endif /* _KERNEL_MM_LRU_H */
@@ -0,0 +1,64 @@
+#ifndef _KERNEL_MM_MEMPOOL_H
+#define _KERNEL_MM_MEMPOOL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef void *(*mempool_alloc_fn_t)(void *pool_data);
+typedef void (*mempool_free_fn_t)(void *elem, void *pool_data);
+
+/**
+ * A reserve of preallocated objects for allocations that must succeed.
+ *
+ * Objects come from the backing allocator while it has memory.
+ * Once it fails, the reserve is used instead.
+ * The reserve is refilled by frees and by mempool_refill(), never from the failure path.
+ */
+struct mempool {
+        mempool_alloc_fn_t alloc;
+        mempool_free_fn_t free;
+        void *pool_data;
+
+        void **reserve;
+        size_t min_nr;  /**< The capacity of the reserve. */
+        size_t curr_nr; /**< The number of objects in the reserve. */
+};
+
+/**
+ * @brief Initialize an empty pool.
+ * @param reserve Space for min_nr object pointers.
+ */
+void mempool_init(struct mempool *pool, void **reserve, size_t min_nr, mempool_alloc_fn_t alloc,
+                  mempool_free_fn_t free, void *pool_data);
+
+/**
+ * @brief Top up the reserve from the backing allocator.
+ * @return true if the reserve is full.
+ */
+bool mempool_refill(struct mempool *pool);
+
+/**
+ * @brief Free every object of the reserve.
+ */
+void mempool_drain(struct mempool *pool);
+
+/**
+ * @return An object or NULL if both the backing allocator and the reserve are exhausted.
+ */
+void *mempool_alloc(struct mempool *pool);
+
+/**
+ * @brief Take an object from the reserve only.
+ *
+ * For the paths that must not allocate, e.g. the reclaim.
+ * @return An object or NULL if the reserve is empty.
+ */
+void *mempool_alloc_reserved(struct mempool *pool);
+
+void mempool_free(struct mempool *pool, void *elem);
+
+/* Backing allocators. The pool data is a struct kmm_cache. */
+void *mempool_alloc_slab(void *cache);
+void mempool_free_slab(void *elem, void *cache);
+
+#endif /* _KERNEL_MM_MEMPOOL_H */
@@ -5,6 +5,7 @@
 #include "kernel/mm/vm.h"
 
 #include "lib/cppdefs.h"
+#include "lib/ds/dclist.h"
 #include "lib/ds/slist.h"
 #include "lib/mm/buddy.h"
 
@@ -18,6 +19,18 @@ struct mm_page {
                 PAGESTATE_OCCUPIED,
                 PAGESTATE_FIXED, /**< A page must remain in memory. */
         } state;
+
+        uint16_t pt_used; /**< The number of present entries if the page is a Page Table. */
+
+        /* Reclaimable pages are kept on the LRU lists. Each of them has a single mapping. */
+        enum page_lru {
+                PAGELRU_NONE,
+                PAGELRU_ACTIVE,
+                PAGELRU_INACTIVE,
+        } lru_state;
+        DCLIST_FIELD(struct mm_page) lru;
+        struct vm_area *lru_area;
+        void *lru_addr;
 };
 
 void mm_page_init_free(struct mm_page *, void *phys_addr);
@@ -0,0 +1,51 @@
+#ifndef _KERNEL_MM_SHRINKER_H
+#define _KERNEL_MM_SHRINKER_H
+
+#include "lib/ds/slist.h"
+
+#include <stddef.h>
+
+/* The gentlest priority. Each step down doubles the share of objects that is asked for. */
+#define SHRINKER_PRIORITY_DEFAULT (8U)
+
+/**
+ * A subsystem that is able to give memory back on demand.
+ * Objects are whatever the subsystem counts in; ideally, pages.
+ *
+ * When the memory runs out, shrinkers are called right from the page allocation, which may
+ * happen in a page fault in the middle of any operation of the subsystem. Shrinkers must skip
+ * the structures that are being updated.
+ */
+struct shrinker {
+        const char *name;
+
+        /**
+         * @brief Count the objects that could be freed right now.
+         */
+        size_t (*count)(struct shrinker *s);
+
+        /**
+         * @brief Try to free up to nr objects.
+         * @return The number of objects freed.
+         */
+        size_t (*scan)(struct shrinker *s, size_t nr);
+
+        unsigned seeks; /**< The cost of recreating an object. Cheaper shrinkers are asked first. */
+
+        struct slist_ref list;
+};
+
+void shrinker_register(struct shrinker *s);
+
+void shrinker_unregister(struct shrinker *s);
+
+/**
+ * @brief Ask every shrinker for a part of its objects.
+ *
+ * A shrinker is asked for (count >> priority) objects, but at least one.
+ * Callers repeat with decreasing priority while the pressure remains.
+ * @return The number of objects freed.
+ */
+size_t shrinkers_run(unsigned priority);
+
+#endif /* _KERNEL_MM_SHRINKER_H */
@@ -0,0 +1,40 @@
+#ifndef _KERNEL_MM_SWAP_H
+#define _KERNEL_MM_SWAP_H
+
+#include "kernel/blkdev.h"
+
+#include <stdbool.h>
+
+/*
+ * Pages are swapped out to the compressed store first.
+ * Those that don't compress well enough go to the swap device.
+ */
+
+/**
+ * @brief Initialize the swap.
+ * @param dev The swap device with blocks of a page. May be NULL.
+ */
+void swap_init(struct blkdev *dev);
+
+/**
+ * @brief Save the page under the key.
+ *
+ * It doesn't allocate memory, so it may be called from the reclaim. The device must not
+ * allocate on writes either.
+ * @return false if there is no space left.
+ */
+bool swap_out(void const *key, void const *page);
+
+bool swap_contains(void const *key);
+
+/**
+ * @brief Read the page back into the buffer and release its space.
+ */
+void swap_in(void const *key, void *page);
+
+/**
+ * @brief Release the space of the page if it's swapped out.
+ */
+void swap_drop(void const *key);
+
+#endif /* _KERNEL_MM_SWAP_H */
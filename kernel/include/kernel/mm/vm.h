@@ -24,10 +24,23 @@ struct vm_area *vm_new_area_within_space(struct vm_space *space, size_t min_size
  */
 void vm_free_area(struct vm_area *area);
 
+/**
+ * @brief Merge the area with adjacent areas of the same kind if their owner allows it.
+ * @return The area that covers the range now. The passed area may be freed by the call.
+ */
+struct vm_area *vm_merge_area(struct vm_area *area);
+
+/**
+ * @brief Split the area in two at the given offset if its owner allows it.
+ * @return The new area that starts at the offset or NULL.
+ */
+struct vm_area *vm_split_area(struct vm_area *area, size_t offset);
+
 /**
  * @brief Page Fault function that panics on page faults.
  */
-__noreturn void vm_pgfault_handle_panic(struct vm_area *area, virt_addr_t addr);
+__noreturn void vm_pgfault_handle_panic(struct vm_area *area, virt_addr_t addr,
+                                        enum vm_fault_flags fault);
 
 /**
  * @brief Iterate over all virtual addresses that are, for some reason, not available for use.
@@ -45,20 +58,74 @@ __const bool vm_arch_is_range_valid(void const *base, size_t len);
  */
 __const void *vm_arch_get_early_pgroot(void);
 
+/**
+ * @brief Make the kernel fault on writes to read-only pages, as any other code does.
+ *
+ * Without that, kernel writes go through read-only mappings silently.
+ */
+void vm_arch_write_protect_enable(void);
+
+/**
+ * @brief Temporarily map a physical frame into one of the current CPU's kmap slots.
+ *
+ * Slots are taken in a stack-like manner, so nested users (e.g. a page fault that happens
+ * while a frame is mapped) get their own slot. Releasing a slot clears its mapping and
+ * invalidates it in the TLB, so every kmap/kunmap pair costs one invalidation.
+ * @return Virtual address of the mapped frame.
+ */
+void *vm_arch_kmap(phys_addr_t frame);
+
+/**
+ * @brief Release the kmap slot. Slots must be released in the reverse order.
+ */
+void vm_arch_kunmap(void *vaddr);
+
+/**
+ * @brief Top up the reserve of zeroed frames for new Page Tables.
+ *
+ * Must not be called from a page fault. The reserve lets the faults grow the page trees
+ * without zeroing frames. Taking a table from the reserve schedules a deferred refill.
+ */
+void vm_arch_pt_pool_refill(void);
+
 /**
  * @brief Resolve the virtual address to it's physicall address *from it's vmspace*.
+ * @return The physical address or NULL if the page isn't mapped.
  */
 void *vm_arch_resolve_phys_page(void *tree_root, void const *virt_page);
 
+/**
+ * @brief Check whether the page has been accessed since the last check.
+ * @return false if the page isn't mapped.
+ */
+bool vm_arch_pt_test_and_clear_accessed(void *tree_root, void *virt_page);
+
 /**
  * @brief Map the virtual address to the physical address for the given page tree.
  */
 void vm_arch_pt_map(void *tree_root, const void *phys_addr, const void *at_virt_addr,
                     enum vm_flags flags);
 
+/**
+ * @brief Point an existing mapping of the virtual address to another physical address.
+ *
+ * Unlike an unmap followed by a map, the Page Table is never released in between.
+ */
+void vm_arch_pt_remap(void *tree_root, const void *phys_addr, void *at_virt_addr,
+                      enum vm_flags flags);
+
 /**
  * @brief Remove mapping for the virtul address.
+ *
+ * Page Tables that become empty are returned to MM.
  */
 void vm_arch_pt_unmap(void *tree_root, void *virt_addr);
 
+/**
+ * @brief Remove mappings for the range of pages.
+ *
+ * Unlike a loop over vm_arch_pt_unmap(), the TLB is invalidated once per Page Table.
+ */
+void vm_arch_pt_unmap_range(void *tree_root, void *virt_addr, size_t pages);
+
 #endif /* _KERNEL_MM_VM_H */
@@ -7,12 +7,14 @@
 #include "lib/ds/rbtree.h"
 #include "lib/ds/slist.h"
 
+#include <stdbool.h>
 #include <stddef.h>
 
 enum vm_flags {
         VM_WRITE = 0x1 << 0,
         VM_USER = 0x1 << 1,
         VM_CACHE_OFF = 0x1 << 2,
+        VM_WRITE_COMBINE = 0x1 << 3, /**< Uncached, but writes may be buffered and combined. */
 };
 
 /**
@@ -28,9 +30,22 @@ struct vm_area {
         struct vm_space *owner;
 
         struct vm_area_ops {
-                void (*handle_pg_fault)(struct vm_area *area, void *addr);
+                void (*handle_pg_fault)(struct vm_area *area, void *addr,
+                                        enum vm_fault_flags fault);
                 void *(*register_map)(struct vm_area *area, void *arg);
                 void (*unregister_map)(struct vm_area *area, void *arg);
+                /* Optional. Areas that provide them must come from vm_new_area_within_space().
+                 * merge() takes the data of the next area; split() hands a part of it to the tail.
+                 * Both run under the space lock, so they must not allocate or free memory:
+                 * that may need the lock again. split_prepare() runs before the lock is taken
+                 * and may stash whatever split() needs in tail->data. Things that aren't needed
+                 * any more are put to the garbage list, and release() frees them after unlock. */
+                bool (*merge)(struct vm_area *area, struct vm_area *next,
+                              struct slist_ref *garbage);
+                bool (*split_prepare)(struct vm_area *area, struct vm_area *tail);
+                bool (*split)(struct vm_area *area, struct vm_area *tail,
+                              struct slist_ref *garbage);
+                void (*release)(struct slist_ref *garbage);
         } ops;
         void *data;
 };
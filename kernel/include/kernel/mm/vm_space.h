@@ -6,6 +6,8 @@
 #include "lib/cppdefs.h"
 #include "lib/ds/rbtree.h"
 #include "lib/ds/slist.h"
+#include "lib/sync/seqcount.h"
+#include "lib/sync/spinlock.h"
 
 #include <stdbool.h>
 
@@ -18,6 +20,9 @@ struct vm_space {
 
         struct rbtree rb_areas;
         struct slist_ref sorted_areas;
+
+        struct spinlock lock; /**< Serializes changes of the areas. */
+        struct seqcount areas_seq; /**< Lets vm_space_find_area() go without the lock. */
 };
 
 /**
@@ -28,10 +33,46 @@ struct vm_space {
  */
 void vm_space_init(struct vm_space *space, phys_addr_t root_pdir, uintptr_t offset);
 
+/**
+ * @brief Take the lock that must be held while looking for gaps or changing the areas.
+ *
+ * Page faults don't take it. So nothing that may fault must happen under the lock.
+ */
+void vm_space_lock(struct vm_space *space);
+
+void vm_space_unlock(struct vm_space *space);
+
+/**
+ * @brief Find the area that covers the address. Doesn't require the lock.
+ *
+ * The search is retried if the areas have been changed while it was in progress.
+ */
+struct vm_area *vm_space_find_area(struct vm_space *space, void const *addr);
+
 void vm_space_insert_area(struct vm_space *space, struct vm_area *area);
 
 void vm_space_remove_area(struct vm_space *space, struct vm_area *area);
 
+/**
+ * @brief Get the area that ends right where the given one starts.
+ */
+struct vm_area *vm_space_prev_adjacent(struct vm_space *space, struct vm_area *area);
+
+/**
+ * @brief Get the area that starts right where the given one ends.
+ */
+struct vm_area *vm_space_next_adjacent(struct vm_space *space, struct vm_area *area);
+
+/**
+ * @brief Extend the area over the next one and remove the latter from the space.
+ */
+void vm_space_merge_areas(struct vm_space *space, struct vm_area *area, struct vm_area *next);
+
+/**
+ * @brief Shrink the area up to the tail's base and insert the tail right after it.
+ */
+void vm_space_split_area(struct vm_space *space, struct vm_area *area, struct vm_area *tail);
+
 /**
  * @brief Find a gap in the vmspace that is chosen by the given predicate.
  */
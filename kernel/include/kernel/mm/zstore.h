@@ -0,0 +1,40 @@
+#ifndef _KERNEL_MM_ZSTORE_H
+#define _KERNEL_MM_ZSTORE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * A store of compressed pages in memory.
+ *
+ * Owners of pages that aren't used for a while may keep them here and give up their frames.
+ * Pages are identified by a key, which is usually their virtual address.
+ */
+
+void zstore_init(void);
+
+/**
+ * @brief Compress the page and keep it under the key.
+ * It never allocates, so it may be called from the reclaim.
+ * @return false if the page doesn't compress well enough or there is no memory for it.
+ */
+bool zstore_store(void const *key, void const *page);
+
+bool zstore_contains(void const *key);
+
+/**
+ * @brief Decompress the page into the buffer and forget it.
+ */
+void zstore_load(void const *key, void *page);
+
+/**
+ * @brief Forget the page if it's there.
+ */
+void zstore_drop(void const *key);
+
+/**
+ * @return The number of pages in the store.
+ */
+size_t zstore_pages(void);
+
+#endif /* _KERNEL_MM_ZSTORE_H */
@@ -0,0 +1,18 @@
+#ifndef _KERNEL_RAMDISK_H
+#define _KERNEL_RAMDISK_H
+
+#include "kernel/blkdev.h"
+
+#include <stddef.h>
+
+/**
+ * @brief Create a block device in memory with blocks of a page.
+ *
+ * Its frames aren't mapped anywhere and are accessed through kmap.
+ * A block gets a frame on the first write and gives it back when discarded. Blocks that
+ * haven't been written to read as zeroes.
+ * @return The device or NULL if there is not enough memory.
+ */
+struct blkdev *ramdisk_create(const char *name, size_t blocks);
+
+#endif /* _KERNEL_RAMDISK_H */
@@ -36,6 +36,10 @@ struct resource {
                 struct {
                         void *base;
                         size_t len;
+                        enum resource_buffer_kind {
+                                RESOURCE_BUFFER_MMIO = 0x0,
+                                RESOURCE_BUFFER_FRAMEBUFFER = 0x1,
+                        } kind;
                 } dev_buffer;
         } data;
 };
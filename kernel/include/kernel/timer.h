@@ -15,6 +15,8 @@ struct int_timer {
 };
 
 void timer_init(void);
+
+/* Callbacks are called from the timer interrupt with the interrupts disabled. */
 void timer_call_after(unsigned ms, callback_fn);
 void timer_call_every(unsigned ms, callback_fn);
 
@@ -0,0 +1,44 @@
+#ifndef _LIB_COMPRESS_LZ_H
+#define _LIB_COMPRESS_LZ_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A fast LZ77 compressor in the spirit of LZ4.
+ *
+ * The stream is a sequence of tokens. The high nibble of a token is the length of the literal
+ * run that follows it, the low nibble is the match length without LZ_MIN_MATCH.
+ * A nibble of 15 is continued with bytes that are added to it until a byte below 255.
+ * A match is encoded as a 16-bit little-endian offset back from the current position.
+ * The last token has literals only.
+ */
+
+#define LZ_MIN_MATCH  (4U)
+#define LZ_MAX_OFFSET (UINT16_MAX)
+#define LZ_HASH_BITS  (12U)
+
+/**
+ * @brief The compressor's working memory.
+ *
+ * It's big enough for kernel stacks to be a bad place for it.
+ */
+struct lz_state {
+        uint16_t table[1U << LZ_HASH_BITS];
+};
+
+/**
+ * @brief Compress the source into the destination.
+ * @param src_len Must not exceed LZ_MAX_OFFSET.
+ * @return The compressed length or 0 if the result doesn't fit into dst_cap.
+ */
+size_t lz_compress(struct lz_state *st, void const *src, size_t src_len, void *dst,
+                   size_t dst_cap);
+
+/**
+ * @brief Decompress the stream.
+ * @return The decompressed length or 0 if the stream is malformed or doesn't fit into dst_cap.
+ */
+size_t lz_decompress(void const *src, size_t src_len, void *dst, size_t dst_cap);
+
+#endif /* _LIB_COMPRESS_LZ_H */
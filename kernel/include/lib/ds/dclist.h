@@ -27,6 +27,8 @@
 #define DCLIST_NEXT(node, fieldname) ((node)->fieldname.next)
 #define DCLIST_FIRST(head)           ((head)->first)
 #define DCLIST_EMPTY(head)           (DCLIST_FIRST(head) == NULL)
+#define DCLIST_LAST(head, fieldname) \
+        (DCLIST_EMPTY(head) ? NULL : DCLIST_PREV(DCLIST_FIRST(head), fieldname))
 
 #define DCLIST_FOREACH_FORWARD(iterv, from_node, fieldname) \
         for ((iterv) = (from_node); (iterv) != NULL; (iterv) = DCLIST_NEXT((iterv), (fieldname)))
@@ -50,4 +52,31 @@
                 DCLIST_PREV(elem, fieldname) = (insertee);                         \
         } while (0)
 
+#define DCLIST_INSERT_FIRST(head, insertee, fieldname)                                 \
+        do {                                                                           \
+                if (DCLIST_EMPTY(head)) {                                              \
+                        DCLIST_NEXT(insertee, fieldname) = (insertee);                 \
+                        DCLIST_PREV(insertee, fieldname) = (insertee);                 \
+                } else {                                                               \
+                        DCLIST_INSERT_BEFORE(DCLIST_FIRST(head), insertee, fieldname); \
+                }                                                                      \
+                DCLIST_FIRST(head) = (insertee);                                       \
+        } while (0)
+
+#define DCLIST_REMOVE(head, elem, fieldname)                                       \
+        do {                                                                       \
+                if (DCLIST_NEXT(elem, fieldname) == (elem)) {                      \
+                        DCLIST_FIRST(head) = NULL;                                 \
+                } else {                                                           \
+                        DCLIST_PREV(DCLIST_NEXT(elem, fieldname), fieldname) =     \
+                                DCLIST_PREV(elem, fieldname);                      \
+                        DCLIST_NEXT(DCLIST_PREV(elem, fieldname), fieldname) =     \
+                                DCLIST_NEXT(elem, fieldname);                      \
+                        if (DCLIST_FIRST(head) == (elem)) {                        \
+                                DCLIST_FIRST(head) = DCLIST_NEXT(elem, fieldname); \
+                        }                                                          \
+                }                                                                  \
+                DCLIST_FIELD_INIT(elem, fieldname);                                \
+        } while (0)
+
 #endif /* _LIB_DS_DCLIST_H */
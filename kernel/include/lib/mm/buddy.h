@@ -26,8 +26,10 @@ size_t buddy_init(struct buddy_manager *bmgr, size_t pages, struct linear_alloc
 
 /**
  * @brief Allocate specified number of pages.
+ *
+ * Pages of a block may be freed one by one later.
  * @param order 2^(order) of required pages.
- * @param result An index of the allocated page/pages.
+ * @param result An index of the first allocated page. It's aligned to 2^(order).
  * @return Indicates success of the operation.
  */
 bool buddy_alloc(struct buddy_manager *bmgr, size_t order, size_t *result);
@@ -0,0 +1,60 @@
+#ifndef _LIB_SYNC_SEQCOUNT_H
+#define _LIB_SYNC_SEQCOUNT_H
+
+#include "lib/sync/spinlock.h"
+
+#include <stdbool.h>
+
+/**
+ * A sequence counter lets readers go through data without taking any locks.
+ * A reader remembers the sequence before it starts and retries if the sequence has changed.
+ * The sequence is odd while a writer is in progress.
+ *
+ * Writers must be serialized by some other means.
+ */
+struct seqcount {
+        unsigned sequence;
+};
+
+static inline void seqcount_init(struct seqcount *s)
+{
+        __atomic_store_n(&s->sequence, 0, __ATOMIC_RELAXED);
+}
+
+/**
+ * @brief Start a read section. Waits for an active writer to finish.
+ * @return The sequence to pass to seqcount_read_retry().
+ */
+static inline unsigned seqcount_read_begin(struct seqcount const *s)
+{
+        unsigned seq;
+        while ((seq = __atomic_load_n(&s->sequence, __ATOMIC_ACQUIRE)) & 0x1) {
+                spinlock_relax();
+        }
+        return (seq);
+}
+
+/**
+ * @brief Finish a read section.
+ * @return True if a writer has run since seqcount_read_begin() and the data must be read again.
+ */
+static inline bool seqcount_read_retry(struct seqcount const *s, unsigned start)
+{
+        /* The reads of the data must complete before the sequence is checked. */
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return (__atomic_load_n(&s->sequence, __ATOMIC_RELAXED) != start);
+}
+
+static inline void seqcount_write_begin(struct seqcount *s)
+{
+        __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELAXED);
+        /* Readers must see the odd sequence before any changes to the data. */
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static inline void seqcount_write_end(struct seqcount *s)
+{
+        __atomic_store_n(&s->sequence, s->sequence + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* _LIB_SYNC_SEQCOUNT_H */
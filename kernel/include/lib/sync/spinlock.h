@@ -0,0 +1,51 @@
+#ifndef _LIB_SYNC_SPINLOCK_H
+#define _LIB_SYNC_SPINLOCK_H
+
+#include "lib/cppdefs.h"
+
+#include <stdbool.h>
+
+struct spinlock {
+        bool locked;
+};
+
+static inline void spinlock_relax(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+        asm volatile("pause" ::: "memory");
+#else
+        asm volatile("" ::: "memory");
+#endif
+}
+
+static inline void spinlock_init(struct spinlock *l)
+{
+        __atomic_clear(&l->locked, __ATOMIC_RELAXED);
+}
+
+static inline bool spinlock_trylock(struct spinlock *l)
+{
+        return (!__atomic_test_and_set(&l->locked, __ATOMIC_ACQUIRE));
+}
+
+static inline void spinlock_lock(struct spinlock *l)
+{
+        while (!spinlock_trylock(l)) {
+                /* Don't bounce the cache line while someone holds the lock. */
+                while (__atomic_load_n(&l->locked, __ATOMIC_RELAXED)) {
+                        spinlock_relax();
+                }
+        }
+}
+
+static inline void spinlock_unlock(struct spinlock *l)
+{
+        __atomic_clear(&l->locked, __ATOMIC_RELEASE);
+}
+
+static inline bool spinlock_is_locked(struct spinlock *l)
+{
+        return (__atomic_load_n(&l->locked, __ATOMIC_RELAXED));
+}
+
+#endif /* _LIB_SYNC_SPINLOCK_H */
@@ -0,0 +1,50 @@
+#include "kernel/deferred.h"
+
+#include "lib/cstd/assert.h"
+#include "lib/ds/slist.h"
+#include "lib/utils.h"
+
+#include <stdbool.h>
+
+static struct slist_ref WORKS;
+static bool RUNNING = false;
+
+void deferred_register(struct deferred_work *w)
+{
+        kassert(w != NULL);
+        kassert(w->fn != NULL);
+
+        /* Subsystems may be reinitialized. */
+        SLIST_FOREACH (it, slist_next(&WORKS)) {
+                if (it == &w->list) {
+                        return;
+                }
+        }
+
+        slist_init(&w->list);
+        slist_insert(&WORKS, &w->list);
+}
+
+void deferred_schedule(struct deferred_work *w)
+{
+        kassert(w != NULL);
+        __atomic_store_n(&w->pending, true, __ATOMIC_RELEASE);
+}
+
+void deferred_run(void)
+{
+        /* The work may allocate, and an allocation may ask for more work. */
+        if (RUNNING) {
+                return;
+        }
+        RUNNING = true;
+
+        SLIST_FOREACH (it, slist_next(&WORKS)) {
+                struct deferred_work *w = container_of(it, struct deferred_work, list);
+                if (__atomic_exchange_n(&w->pending, false, __ATOMIC_ACQUIRE)) {
+                        w->fn();
+                }
+        }
+
+        RUNNING = false;
+}
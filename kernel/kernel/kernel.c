@@ -2,16 +2,21 @@
 
 #include "kernel/config.h"
 #include "kernel/console.h"
+#include "kernel/deferred.h"
 #include "kernel/klog.h"
 #include "kernel/mm/addr.h"
 #include "kernel/mm/dev.h"
 #include "kernel/mm/kheap.h"
 #include "kernel/mm/kmalloc.h"
 #include "kernel/mm/kmm.h"
+#include "kernel/mm/kstack.h"
+#include "kernel/mm/lru.h"
 #include "kernel/mm/mm.h"
+#include "kernel/mm/swap.h"
 #include "kernel/mm/vm.h"
 #include "kernel/modules.h"
 #include "kernel/resources.h"
+#include "kernel/timer.h"
 
 #include "lib/align.h"
 #include "lib/cppdefs.h"
@@ -46,7 +51,9 @@ static void init_kernel_vmspace(void)
 
                 vm_area_init(a, (void *)start, len, &CURRENT_KERNEL);
                 a->ops.handle_pg_fault = vm_pgfault_handle_panic;
+                vm_space_lock(&CURRENT_KERNEL);
                 vm_space_insert_area(&CURRENT_KERNEL, a);
+                vm_space_unlock(&CURRENT_KERNEL);
         }
 }
 
@@ -83,6 +90,9 @@ __noreturn static void test_allocation(void)
 {
         size_t overall = 0;
         for (int i = 0;; i++) {
+                /* Nothing is half-updated between the allocations. */
+                deferred_run();
+
                 void *mem = kmalloc(0x700);
                 if (mem != NULL) {
                         overall += 0x700;
@@ -94,6 +104,22 @@ __noreturn static void test_allocation(void)
         }
 }
 
+/* Runs on a kernel stack with a guard page. The boot stack has none. */
+__noreturn static void kernel_main(void)
+{
+        timer_init();
+        timer_call_every(CONF_KMM_REAP_INTERVAL_MS, kmm_reap_tick);
+        timer_call_every(CONF_HEAP_SHRINK_INTERVAL_MS, kheap_shrink_tick);
+
+        dev_init();
+        kdev_init(&CURRENT_KERNEL);
+
+        modules_init();
+        modules_load_available();
+
+        test_allocation();
+}
+
 __noreturn void kernel_init(void)
 {
         consoles_init();
@@ -104,16 +130,20 @@ __noreturn void kernel_init(void)
         mm_init();
         vm_init();
         register_mem_zones();
+        vm_arch_pt_pool_refill();
         kheap_init(&CURRENT_KERNEL);
         kmm_init(kheap_alloc_page, kheap_free_page);
+        kheap_reserve_refill();
         kmalloc_init(CONF_MALLOC_MIN_POW, CONF_MALLOC_MAX_POW);
+        /* A RAM disk can't be the swap device: every page written to it takes a frame. */
+        swap_init(NULL);
+        lru_init();
         LOGF_I("Kernel Memory Manager is... Up and running\n");
 
-        dev_init();
-        kdev_init(&CURRENT_KERNEL);
-
-        modules_init();
-        modules_load_available();
-
-        test_allocation();
+        kstack_init(&CURRENT_KERNEL);
+        void *const stack = kstack_alloc();
+        if (__unlikely(stack == NULL)) {
+                LOGF_P("Couldn't allocate the kernel stack.\n");
+        }
+        kernel_arch_switch_stack(stack, kernel_main);
 }
@@ -1,16 +1,21 @@
 #include "kernel/mm/kheap.h"
 
 #include "kernel/config.h"
+#include "kernel/deferred.h"
 #include "kernel/klog.h"
-#include "kernel/mm/kmalloc.h"
 #include "kernel/mm/kmm.h"
+#include "kernel/mm/lru.h"
+#include "kernel/mm/mempool.h"
 #include "kernel/mm/mm.h"
+#include "kernel/mm/swap.h"
 #include "kernel/mm/vm.h"
+#include "kernel/mm/vm_space.h"
 #include "kernel/platform_consts.h"
 
 #include "lib/align.h"
 #include "lib/cppdefs.h"
 #include "lib/cstd/string.h"
+#include "lib/ds/rbtree.h"
 #include "lib/mm/buddy.h"
 #include "lib/mm/linear.h"
 #include "lib/utils.h"
@@ -19,14 +24,38 @@
 #include <stddef.h>
 
 static struct kmm_cache CHUNK_DATA_CACHE;
+/* Buddy metadata of chunks. Objects fit the metadata of the biggest chunk. */
+static struct kmm_cache CHUNK_META_CACHE;
+
+/* A new chunk is created exactly when the heap runs low on memory.
+ * The reserves guarantee that the creation gets what it allocates. */
+static struct mempool CHUNK_DATA_POOL;
+static void *CHUNK_DATA_RESERVE[CONF_HEAP_RESERVED_CHUNKS];
+static struct mempool CHUNK_META_POOL;
+static void *CHUNK_META_RESERVE[CONF_HEAP_RESERVED_CHUNKS];
 
 static struct vm_space *VMSPACE = NULL;
 
+/* Read faults on heap pages map this frame; it's never written to. */
+static phys_addr_t ZERO_PAGE = NULL;
+
 static struct vm_area CHUNK_FIRST = { 0 };
+/* Chunks with free pages are kept in lists by how full they are.
+ * Allocations take the fullest chunk, so emptier chunks have a chance to become completely free. */
+#define CHUNK_FILL_CLASSES (8U)
+#define CHUNK_CLASS_NONE   (CHUNK_FILL_CLASSES)
+
 struct chunk_data {
         struct slist_ref list;
+        struct slist_ref avail_list;
+        unsigned fill_class; /**< The avail list the chunk is in. Lower is fuller. */
         struct vm_area *owner;
         size_t free_space;
+        size_t capacity; /**< The free space when nothing is allocated from the chunk. */
+
+        struct slist_ref empty_list;
+        bool is_empty;
+        unsigned long empty_since; /**< The heap clock at the moment the chunk became empty. */
 
         struct buddy_manager buddy;
         struct linear_alloc buddy_alloc;
@@ -34,13 +63,66 @@ struct chunk_data {
 
 struct {
         struct slist_ref head_list;
+        struct slist_ref avail_lists[CHUNK_FILL_CLASSES];
+        struct slist_ref empty_list;
         size_t heap_free_space;
+        unsigned long clock; /**< Counts shrink intervals. */
+        bool growing;
+        bool shrinking;
+
+        struct rbtree buffers; /**< Keyed by the base address. */
 } GLOBAL_DATA;
 
+/* Buffers of kheap_alloc_pages() hold plain data, unlike the pages of the allocators' own
+ * bookkeeping. So their pages may be swapped out and faulted back in at any time. */
+struct heap_buffer {
+        struct rbtree_node node;
+        void *base;
+        size_t pages;
+};
+/* It has the geometry of the swap entries, so the two caches share slabs. */
+static struct kmm_cache HEAP_BUFFER_CACHE;
+
+static int buffer_cmp(void const *tree_buffer, void const *buffer)
+{
+        uintptr_t const x = (uintptr_t)((struct heap_buffer const *)tree_buffer)->base;
+        uintptr_t const y = (uintptr_t)((struct heap_buffer const *)buffer)->base;
+        return (x < y ? -1 : x > y);
+}
+
+/* Buffers don't overlap, so the one that contains the address is equal to it. */
+static int buffer_addr_cmp(void const *tree_buffer, void const *addr)
+{
+        struct heap_buffer const *b = tree_buffer;
+        uintptr_t const start = (uintptr_t)b->base;
+        uintptr_t const end = start + b->pages * PLATFORM_PAGE_SIZE;
+        uintptr_t const address = (uintptr_t)addr;
+
+        if (address < start) {
+                return (1);
+        }
+        return (address < end ? 0 : -1);
+}
+
+static struct heap_buffer *find_buffer(void *addr)
+{
+        struct rbtree_node *node = rbtree_search(&GLOBAL_DATA.buffers, addr, buffer_addr_cmp);
+        return (node != NULL ? node->data : NULL);
+}
+
+static bool is_buffer_page(void *page)
+{
+        return (find_buffer(page) != NULL);
+}
+
 #define HEAP_VM_FLAGS (VM_WRITE)
-/* 1 page should be always available in case if we will need to allocate a new area,
- * but the cache doesn't contain free slabs. */
 #define CHUNK_AREA_MIN_SPACE (2 * PLATFORM_PAGE_SIZE)
+/* A new chunk is created when the free space drops below the watermark.
+ * The rest of the pages serve the page tables and the reserves' refill. */
+#define HEAP_LOW_WATERMARK (CONF_HEAP_LOW_WATERMARK_PAGES * PLATFORM_PAGE_SIZE)
+/* An empty chunk is released only if the heap keeps at least that much free space without it.
+ * The gap between the watermarks stops the heap from growing and shrinking over and over. */
+#define HEAP_HIGH_WATERMARK (CONF_HEAP_HIGH_WATERMARK_PAGES * PLATFORM_PAGE_SIZE)
 
 static bool area_page_ndx(struct vm_area *area, void *addr, size_t *result)
 {
@@ -71,29 +153,63 @@ static bool is_registered_page(struct vm_area *area, virt_addr_t page)
         return (buddy_is_free(&data->buddy, pg_ndx));
 }
 
-static void chunk_pgfault_handler(struct vm_area *area, void *fault_addr)
+static void chunk_pgfault_handler(struct vm_area *area, void *fault_addr,
+                                  enum vm_fault_flags fault)
 {
         void *const page_addr = align_rounddownptr(fault_addr, PLATFORM_PAGE_SIZE);
 
         if (is_registered_page(area, page_addr)) {
                 /* The page isn't registered in the chunk.
                  * So it's true page fault. */
-                vm_pgfault_handle_panic(area, fault_addr);
+                vm_pgfault_handle_panic(area, fault_addr, fault);
+                return;
+        }
+
+        /* The page has been swapped out while nobody was using it. */
+        if (swap_contains(page_addr)) {
+                kassert(!(fault & VM_FAULT_PRESENT));
+
+                struct mm_page *page = mm_alloc_page();
+                if (__unlikely(page == NULL)) {
+                        LOGF_P("Out of physical memory. Bye.\n");
+                }
+                vm_arch_pt_map(area->owner->root_dir, page->paddr, page_addr, area->flags);
+                swap_in(page_addr, page_addr);
+                lru_add(page, area, page_addr);
                 return;
         }
 
         /* The page is registered in the chunk, but mappings are missing.
-         * For now, it means that we haven't allocated the page yet. */
+         * Otherwise, it means that we haven't allocated the page yet.
+         * Reads don't need a frame of their own until something is written to the page. */
+        if (!(fault & VM_FAULT_WRITE)) {
+                kassert(!(fault & VM_FAULT_PRESENT));
+                vm_arch_pt_map(area->owner->root_dir, ZERO_PAGE, page_addr,
+                               area->flags & ~VM_WRITE);
+                return;
+        }
+
         struct mm_page *page = mm_alloc_page();
         if (__unlikely(page == NULL)) {
-                LOGF_W("Not enough physicall space. Trying to trim some caches.\n");
-                kmm_cache_trim_all();
-                page = mm_alloc_page();
-                if (__unlikely(page == NULL)) {
-                        LOGF_P("Couldn't trim enough space. Bye.\n");
-                }
+                /* The allocator has already asked the shrinkers for everything they had. */
+                LOGF_P("Out of physical memory. Bye.\n");
+        }
+
+        /* A write to a present page means that the zero page was mapped there.
+         * The entry is replaced in place, so its Page Table can't be released in between. */
+        bool const was_zero = fault & VM_FAULT_PRESENT;
+        if (was_zero) {
+                kassert(vm_arch_resolve_phys_page(area->owner->root_dir, page_addr) == ZERO_PAGE);
+                vm_arch_pt_remap(area->owner->root_dir, page->paddr, page_addr, area->flags);
+                /* Someone has already seen zeroes there. */
+                kmemset(page_addr, 0x0, PLATFORM_PAGE_SIZE);
+        } else {
+                vm_arch_pt_map(area->owner->root_dir, page->paddr, page_addr, area->flags);
+        }
+
+        if (is_buffer_page(page_addr)) {
+                lru_add(page, area, page_addr);
         }
-        vm_arch_pt_map(area->owner->root_dir, page->paddr, page_addr, area->flags);
 }
 
 static void *chunk_register_page(struct vm_area *chunk, void *page_addr)
@@ -125,6 +241,30 @@ static void *chunk_register_page(struct vm_area *chunk, void *page_addr)
         return (result_addr);
 }
 
+/* Allocate a virtually contiguous range of pages. They are mapped on the first access. */
+static void *chunk_alloc_pages(struct vm_area *chunk, size_t n)
+{
+        struct chunk_data *data = chunk->data;
+        if (data->free_space < n * PLATFORM_PAGE_SIZE) {
+                return (NULL);
+        }
+
+        size_t const order = log2_ceil(n);
+        size_t first_ndx = 0;
+        if (!buddy_alloc(&data->buddy, order, &first_ndx)) {
+                return (NULL);
+        }
+
+        /* Give back the tail of the block that isn't needed. */
+        for (size_t i = n; i < ((size_t)1 << order); i++) {
+                buddy_free(&data->buddy, first_ndx + i, 0);
+        }
+
+        data->free_space -= n * PLATFORM_PAGE_SIZE;
+
+        return ((void *)((uintptr_t)chunk->base + first_ndx * PLATFORM_PAGE_SIZE));
+}
+
 static void chunk_unregister_page(struct vm_area *chunk, void *page_addr)
 {
         kassert(chunk != NULL);
@@ -138,9 +278,27 @@ static void chunk_unregister_page(struct vm_area *chunk, void *page_addr)
         data->free_space += PLATFORM_PAGE_SIZE;
 
         buddy_free(&data->buddy, page_ndx, 0);
-        /* Return the page to MM. */
+
+        /* The page may have never been touched. */
         void *phys_addr = vm_arch_resolve_phys_page(chunk->owner->root_dir, page_addr);
-        mm_free_page(phys_addr);
+        if (phys_addr == NULL) {
+                swap_drop(page_addr);
+                return;
+        }
+
+        if (phys_addr != ZERO_PAGE) {
+                struct mm_page *page = mm_get_page_by_paddr(phys_addr);
+                if (page->lru_state != PAGELRU_NONE) {
+                        lru_remove(page);
+                }
+        }
+
+        vm_arch_pt_unmap(chunk->owner->root_dir, page_addr);
+
+        /* Return the page to MM. */
+        if (phys_addr != ZERO_PAGE) {
+                mm_free_page(phys_addr);
+        }
 }
 
 static struct vm_area_ops HEAP_OPS = {
@@ -205,6 +363,8 @@ static struct vm_area *init_first_chunk(struct vm_space *space)
         struct vm_area *chunk = &CHUNK_FIRST;
         struct chunk_data *data = &FIRST_CHUNK_DATA;
 
+        vm_space_lock(space);
+
         struct find_largest_data fld = { 0 };
         size_t ignore __unused;
         vm_space_find_gap(space, &ignore, find_largest, &fld);
@@ -219,12 +379,17 @@ static struct vm_area *init_first_chunk(struct vm_space *space)
 
         vm_space_insert_area(space, chunk);
 
+        vm_space_unlock(space);
+
         size_t const chunk_pages = len / PLATFORM_PAGE_SIZE;
         size_t const req_space = buddy_predict_req_space(chunk_pages);
         size_t const req_pages = div_ceil(req_space, PLATFORM_PAGE_SIZE);
 
         slist_init(&data->list);
         data->free_space = (chunk_pages - req_pages) * PLATFORM_PAGE_SIZE;
+        data->fill_class = CHUNK_CLASS_NONE;
+        slist_init(&data->avail_list);
+        slist_init(&data->empty_list);
         data->owner = chunk;
 
         /* Map first pages by hands to allow kernel heap to start. */
@@ -268,15 +433,16 @@ static struct vm_area *create_new_chunk(struct vm_space *space)
                 goto fail_return;
         }
 
-        struct chunk_data *data = kmm_cache_alloc(&CHUNK_DATA_CACHE);
+        struct chunk_data *data = mempool_alloc(&CHUNK_DATA_POOL);
         if (__unlikely(data == NULL)) {
                 goto free_area;
         }
 
         size_t const chunk_pages = chunk->length / PLATFORM_PAGE_SIZE;
         size_t const buddy_space = buddy_predict_req_space(chunk_pages);
+        kassert(buddy_space <= CHUNK_META_CACHE.size);
 
-        void *buddy_mem = kmalloc(buddy_space);
+        void *buddy_mem = mempool_alloc(&CHUNK_META_POOL);
         if (__unlikely(buddy_mem == NULL)) {
                 goto free_data;
         }
@@ -288,8 +454,11 @@ static struct vm_area *create_new_chunk(struct vm_space *space)
         linear_forbid_further_alloc(&data->buddy_alloc);
 
         data->free_space = chunk->length;
+        data->fill_class = CHUNK_CLASS_NONE;
         data->owner = chunk;
         slist_init(&data->list);
+        slist_init(&data->avail_list);
+        slist_init(&data->empty_list);
 
         chunk->data = data;
         chunk->ops = HEAP_OPS;
@@ -300,13 +469,69 @@ static struct vm_area *create_new_chunk(struct vm_space *space)
         return (chunk);
 
 free_data:
-        kmm_cache_free(&CHUNK_DATA_CACHE, data);
+        mempool_free(&CHUNK_DATA_POOL, data);
 free_area:
         vm_free_area(chunk);
 fail_return:
         return (NULL);
 }
 
+static unsigned fill_class(struct chunk_data *data)
+{
+        if (data->free_space == 0) {
+                return (CHUNK_CLASS_NONE);
+        }
+
+        return ((data->free_space * CHUNK_FILL_CLASSES - 1) / data->owner->length);
+}
+
+static void track_emptiness(struct chunk_data *data)
+{
+        bool const empty = data->free_space == data->capacity;
+        if (empty == data->is_empty) {
+                return;
+        }
+
+        if (empty) {
+                data->empty_since = GLOBAL_DATA.clock;
+                slist_insert(&GLOBAL_DATA.empty_list, &data->empty_list);
+        } else {
+                slist_remove(&GLOBAL_DATA.empty_list, &data->empty_list);
+        }
+        data->is_empty = empty;
+}
+
+/* Move the chunk to the avail list that matches its free space. */
+static void refile_chunk(struct chunk_data *data)
+{
+        track_emptiness(data);
+
+        unsigned const class = fill_class(data);
+        if (class == data->fill_class) {
+                return;
+        }
+
+        if (data->fill_class != CHUNK_CLASS_NONE) {
+                slist_remove(&GLOBAL_DATA.avail_lists[data->fill_class], &data->avail_list);
+        }
+        if (class != CHUNK_CLASS_NONE) {
+                slist_insert(&GLOBAL_DATA.avail_lists[class], &data->avail_list);
+        }
+        data->fill_class = class;
+}
+
+static struct chunk_data *pick_chunk(void)
+{
+        for (unsigned i = 0; i < CHUNK_FILL_CLASSES; i++) {
+                struct slist_ref *first = slist_next(&GLOBAL_DATA.avail_lists[i]);
+                if (first != NULL) {
+                        return (container_of(first, struct chunk_data, avail_list));
+                }
+        }
+
+        return (NULL);
+}
+
 static void append_new_chunk(struct vm_area *chunk)
 {
         struct slist_ref *current = &GLOBAL_DATA.head_list;
@@ -324,63 +549,289 @@ static void append_new_chunk(struct vm_area *chunk)
 
         struct chunk_data *data = chunk->data;
         slist_insert(current, &data->list);
+        data->capacity = data->free_space;
         GLOBAL_DATA.heap_free_space += data->free_space;
+        refile_chunk(data);
+}
+
+static void destroy_chunk(struct chunk_data *data)
+{
+        struct vm_area *chunk = data->owner;
+        kassert(data->free_space == data->capacity);
+        kassert(!data->is_empty);
+
+        /* Pages are unmapped as soon as they are returned to the chunk.
+         * So only the bookkeeping is left. */
+        if (data->fill_class != CHUNK_CLASS_NONE) {
+                slist_remove(&GLOBAL_DATA.avail_lists[data->fill_class], &data->avail_list);
+        }
+        slist_remove(&GLOBAL_DATA.head_list, &data->list);
+        GLOBAL_DATA.heap_free_space -= data->free_space;
+
+        mempool_free(&CHUNK_META_POOL, (void *)data->buddy_alloc.base);
+        mempool_free(&CHUNK_DATA_POOL, data);
+        vm_free_area(chunk);
+}
+
+/* Release a chunk that has been empty for a while. */
+static void shrink_heap(void)
+{
+        /* Releasing the chunk frees heap pages itself. */
+        if (GLOBAL_DATA.shrinking || GLOBAL_DATA.growing) {
+                return;
+        }
+        GLOBAL_DATA.shrinking = true;
+
+        struct slist_ref *prev = &GLOBAL_DATA.empty_list;
+        while (slist_next(prev) != NULL) {
+                struct slist_ref *it = slist_next(prev);
+                struct chunk_data *d = container_of(it, struct chunk_data, empty_list);
+
+                size_t const spare_space = GLOBAL_DATA.heap_free_space - d->free_space;
+                bool const idle = GLOBAL_DATA.clock - d->empty_since >= CONF_HEAP_CHUNK_IDLE_AGE;
+                bool const spare = spare_space >= HEAP_HIGH_WATERMARK;
+                /* The first chunk keeps its metadata inside itself. */
+                if (d->owner != &CHUNK_FIRST && idle && spare) {
+                        slist_remove_next(prev);
+                        d->is_empty = false;
+                        destroy_chunk(d);
+                        break;
+                }
+
+                prev = it;
+        }
+
+        GLOBAL_DATA.shrinking = false;
+}
+
+static size_t SHRINK_PENDING;
+
+static void shrink_deferred(void)
+{
+        GLOBAL_DATA.clock += __atomic_exchange_n(&SHRINK_PENDING, 0, __ATOMIC_RELAXED);
+        shrink_heap();
+}
+
+/* An idle heap doesn't free pages, so the release doesn't wait for that. */
+static struct deferred_work SHRINK_WORK = {
+        .name = "kheap_shrink",
+        .fn = shrink_deferred,
+};
+
+void kheap_shrink_tick(void)
+{
+        __atomic_add_fetch(&SHRINK_PENDING, 1, __ATOMIC_RELAXED);
+        deferred_schedule(&SHRINK_WORK);
+}
+
+static void grow_heap(void)
+{
+        /* Creation of a chunk allocates pages itself. Those must come from the existing chunks. */
+        if (GLOBAL_DATA.growing) {
+                return;
+        }
+        GLOBAL_DATA.growing = true;
+
+        struct vm_area *chunk = create_new_chunk(VMSPACE);
+        if (__unlikely(chunk == NULL)) {
+                LOGF_P("Couldn't create new heap chunk for some weird reason.\n");
+        }
+        append_new_chunk(chunk);
+
+        /* There is plenty of space now. Prepare for the next time. */
+        kheap_reserve_refill();
+
+        GLOBAL_DATA.growing = false;
+}
+
+static void init_zero_page(void)
+{
+        struct mm_page *p = mm_alloc_page();
+        if (__unlikely(p == NULL)) {
+                LOGF_P("Couldn't allocate the zero page.\n");
+        }
+        p->state = PAGESTATE_FIXED;
+
+        void *mem = vm_arch_kmap(p->paddr);
+        kmemset(mem, 0x0, PLATFORM_PAGE_SIZE);
+        vm_arch_kunmap(mem);
+
+        ZERO_PAGE = p->paddr;
+
+        /* The zero page is shared by every untouched heap page, and the kernel is the one who
+         * writes to them. Writes must fault instead of filling the shared frame. */
+        vm_arch_write_protect_enable();
+}
+
+static void track_buffer(void *pages, size_t n)
+{
+        struct heap_buffer *b = kmm_cache_alloc(&HEAP_BUFFER_CACHE);
+        if (__unlikely(b == NULL)) {
+                /* The buffer just stays resident. */
+                return;
+        }
+
+        b->base = pages;
+        b->pages = n;
+        rbtree_init_node(&b->node);
+        b->node.data = b;
+        rbtree_insert(&GLOBAL_DATA.buffers, &b->node, buffer_cmp);
+}
+
+static void untrack_buffer(void *pages)
+{
+        struct heap_buffer *b = find_buffer(pages);
+        if (b == NULL) {
+                /* There was no memory to track it. */
+                return;
+        }
+
+        kassert(b->base == pages);
+        rbtree_delete(&GLOBAL_DATA.buffers, &b->node);
+        kmm_cache_free(&HEAP_BUFFER_CACHE, b);
 }
 
 void kheap_init(struct vm_space *space)
 {
+        init_zero_page();
+
         slist_init(&GLOBAL_DATA.head_list);
-        kmm_cache_init(&CHUNK_DATA_CACHE, "heap_chunk_data", sizeof(struct chunk_data), 0, 0, NULL,
-                       NULL);
+        for (unsigned i = 0; i < CHUNK_FILL_CLASSES; i++) {
+                slist_init(&GLOBAL_DATA.avail_lists[i]);
+        }
+        slist_init(&GLOBAL_DATA.empty_list);
+        kmm_cache_init(&CHUNK_DATA_CACHE, "heap_chunk_data", sizeof(struct chunk_data), 0,
+                       KMM_CACHE_MERGEABLE, NULL, NULL);
+        size_t const meta_size =
+                buddy_predict_req_space(CONF_HEAP_MAX_CHUNK_SIZE / PLATFORM_PAGE_SIZE);
+        kmm_cache_init(&CHUNK_META_CACHE, "heap_chunk_meta", meta_size, 0, 0, NULL, NULL);
+
+        mempool_init(&CHUNK_DATA_POOL, CHUNK_DATA_RESERVE, ARRAY_SIZE(CHUNK_DATA_RESERVE),
+                     mempool_alloc_slab, mempool_free_slab, &CHUNK_DATA_CACHE);
+        mempool_init(&CHUNK_META_POOL, CHUNK_META_RESERVE, ARRAY_SIZE(CHUNK_META_RESERVE),
+                     mempool_alloc_slab, mempool_free_slab, &CHUNK_META_CACHE);
         VMSPACE = space;
 
+        rbtree_init_tree(&GLOBAL_DATA.buffers);
+        kmm_cache_init(&HEAP_BUFFER_CACHE, "heap_buffers", sizeof(struct heap_buffer), 0,
+                       KMM_CACHE_MERGEABLE, NULL, NULL);
+
         struct vm_area *first = init_first_chunk(space);
         append_new_chunk(first);
+
+        deferred_register(&SHRINK_WORK);
+}
+
+void kheap_reserve_refill(void)
+{
+        if (__unlikely(!mempool_refill(&CHUNK_DATA_POOL) || !mempool_refill(&CHUNK_META_POOL))) {
+                LOGF_W("Couldn't refill the heap reserves.\n");
+        }
 }
 
 void *kheap_alloc_page(void)
 {
-        struct vm_area *chunk = NULL;
-        if (__unlikely(GLOBAL_DATA.heap_free_space == PLATFORM_PAGE_SIZE)) {
-                chunk = create_new_chunk(VMSPACE);
-                if (__unlikely(chunk == NULL)) {
-                        LOGF_P("Couldn't create new heap chunk for some weird reason.\n");
-                }
-                append_new_chunk(chunk);
-        } else {
-                kassert(GLOBAL_DATA.heap_free_space > PLATFORM_PAGE_SIZE);
-
-                SLIST_FOREACH(it, slist_next(&GLOBAL_DATA.head_list)) {
-                        struct chunk_data *d = container_of(it, struct chunk_data, list);
-                        if (d->free_space > 0) {
-                                chunk = d->owner;
-                                break;
-                        }
-                }
+        struct chunk_data *data = pick_chunk();
+        if (__unlikely(data == NULL)) {
+                LOGF_P("The heap has run out of space while growing.\n");
         }
 
-        kassert(chunk != NULL);
+        void *page = vm_area_register_map(data->owner, NULL);
+        kassert(page != NULL);
+
+        GLOBAL_DATA.heap_free_space -= PLATFORM_PAGE_SIZE;
+        refile_chunk(data);
 
-        return (vm_area_register_map(chunk, NULL));
+        if (__unlikely(GLOBAL_DATA.heap_free_space < HEAP_LOW_WATERMARK)) {
+                grow_heap();
+        }
+
+        return (page);
+}
+
+static struct vm_area *find_origin_chunk(void *page)
+{
+        /* Chunks are areas of the space, so the space's tree knows the owner. */
+        struct vm_area *origin = vm_space_find_area(VMSPACE, page);
+
+        if (__unlikely(origin == NULL || origin->ops.handle_pg_fault != chunk_pgfault_handler)) {
+                LOGF_P("Coudln't find origin chunk for the page %p.\n", page);
+        }
+
+        return (origin);
 }
 
 void kheap_free_page(void *page)
 {
-        struct vm_area *origin = NULL;
-        SLIST_FOREACH(it, slist_next(&GLOBAL_DATA.head_list)) {
+        struct vm_area *origin = find_origin_chunk(page);
+
+        vm_area_unregister_map(origin, page);
+
+        GLOBAL_DATA.heap_free_space += PLATFORM_PAGE_SIZE;
+        refile_chunk(origin->data);
+        shrink_heap();
+}
+
+static void *try_alloc_pages(size_t n)
+{
+        SLIST_FOREACH (it, slist_next(&GLOBAL_DATA.head_list)) {
                 struct chunk_data *d = container_of(it, struct chunk_data, list);
 
-                if (d->owner->base <= page) {
-                        origin = d->owner;
-                        break;
+                void *pages = chunk_alloc_pages(d->owner, n);
+                if (pages != NULL) {
+                        GLOBAL_DATA.heap_free_space -= n * PLATFORM_PAGE_SIZE;
+                        refile_chunk(d);
+                        return (pages);
                 }
         }
 
-        if (__unlikely(origin == NULL)) {
-                LOGF_P("Coudln't find origin chunk for the page %p.\n", page);
+        return (NULL);
+}
+
+void *kheap_alloc_pages(size_t n)
+{
+        kassert(n > 0);
+
+        if (__unlikely(n * PLATFORM_PAGE_SIZE > CONF_HEAP_MAX_CHUNK_SIZE / 2)) {
+                LOGF_E("Requested %zu pages, which is more than a chunk can provide.\n", n);
+                return (NULL);
         }
 
-        /* Ensure that the page is related to the chunk. */
-        kassert((uintptr_t)origin->base + origin->length - 1 > (uintptr_t)page);
-        vm_area_unregister_map(origin, page);
+        /* A single page also goes through the buddy path, so that every buffer is untracked by
+         * kheap_free_pages(). Pages of kheap_alloc_page() are never tracked. */
+        void *pages = try_alloc_pages(n);
+        if (pages == NULL) {
+                /* The existing chunks are too fragmented. */
+                grow_heap();
+                pages = try_alloc_pages(n);
+        }
+
+        if (__unlikely(GLOBAL_DATA.heap_free_space < HEAP_LOW_WATERMARK)) {
+                grow_heap();
+        }
+
+        if (pages != NULL) {
+                track_buffer(pages, n);
+        }
+        return (pages);
+}
+
+void kheap_free_pages(void *pages, size_t n)
+{
+        kassert(n > 0);
+        kassert(check_align((uintptr_t)pages, PLATFORM_PAGE_SIZE));
+
+        untrack_buffer(pages);
+
+        struct vm_area *origin = find_origin_chunk(pages);
+        kassert((uintptr_t)pages + n * PLATFORM_PAGE_SIZE <=
+                (uintptr_t)origin->base + origin->length);
+
+        for (size_t i = 0; i < n; i++) {
+                vm_area_unregister_map(origin, (void *)((uintptr_t)pages + i * PLATFORM_PAGE_SIZE));
+        }
+
+        GLOBAL_DATA.heap_free_space += n * PLATFORM_PAGE_SIZE;
+        refile_chunk(origin->data);
+        shrink_heap();
 }
@@ -54,7 +54,8 @@ bool addr_is_high(const void *addr)
         return ((uintptr_t)addr >= OFFSET);
 }
 
-void addr_pgfault_handler_maplow(struct vm_area *area __unused, void *addr)
+void addr_pgfault_handler_maplow(struct vm_area *area __unused, void *addr,
+                                 enum vm_fault_flags fault __unused)
 {
         kassert(area != NULL);
 
@@ -37,12 +37,26 @@ struct region {
         struct slist_ref list;
 };
 
+/* Enums are short, so the state covers only a part of the pointer. A region is free only when
+ * the whole pointer is NULL, otherwise a resource at an address with a zero low byte would
+ * look free. */
+static bool region_is_free(struct region const *r)
+{
+        return (NULL == r->resource.ptr);
+}
+
+static void region_set_free(struct region *r)
+{
+        r->resource.ptr = NULL;
+}
+
 static struct kmm_cache REGIONS_CACHE;
 static struct vm_area *KDEV_AREA = NULL;
 
 void dev_init(void)
 {
-        kmm_cache_init(&REGIONS_CACHE, "dev_regions", sizeof(struct region), 0, 0, NULL, NULL);
+        kmm_cache_init(&REGIONS_CACHE, "dev_regions", sizeof(struct region), 0,
+                       KMM_CACHE_MERGEABLE, NULL, NULL);
 }
 
 static struct region *new_region(struct vm_area *area, size_t len)
@@ -50,7 +64,7 @@ static struct region *new_region(struct vm_area *area, size_t len)
         SLIST_FOREACH (it, area->data) {
                 struct region *r = region_of(it);
 
-                if (r->resource.state != REGION_RES_STATE_FREE || r->length < len) {
+                if (!region_is_free(r) || r->length < len) {
                         continue;
                 }
 
@@ -65,7 +79,7 @@ static struct region *new_region(struct vm_area *area, size_t len)
                         new->length = r->length - len;
                         slist_init(&new->list);
                         slist_insert(&r->list, &new->list);
-                        new->resource.state = REGION_RES_STATE_FREE;
+                        region_set_free(new);
 
                         r->length = len;
                 }
@@ -78,7 +92,10 @@ static struct region *new_region(struct vm_area *area, size_t len)
         return (NULL);
 }
 
-static void free_region_for(struct vm_area *area, struct resource *res, void **region_base, size_t *region_len)
+/* Region base and length are those of the resource itself, not of the free region it ends up
+ * coalesced into. The neighbours are already unmapped. */
+static void free_region_for(struct vm_area *area, struct resource *res, void **region_base,
+                            size_t *region_len)
 {
         struct region *last = NULL;
         SLIST_FOREACH (it, area->data) {
@@ -89,26 +106,25 @@ static void free_region_for(struct vm_area *area, struct resource *res, void **r
                  * 2. Either region before or after the current region is free; coalesce them.
                  * 3. Both regions, before and after, are free; coalesce them all. */
                 if (r->resource.ptr == res) {
-                        r->resource.state = REGION_RES_STATE_FREE;
+                        *region_base = r->page_vaddr;
+                        *region_len = r->length;
+                        region_set_free(r);
 
-                        if (REGION_RES_STATE_FREE == last->resource.state) {
+                        if (NULL != last && region_is_free(last)) {
                                 last->length += r->length;
                                 slist_remove_next(&last->list);
                                 kmm_cache_free(&REGIONS_CACHE, r);
                                 r = last;
                         }
 
-                        *region_base = r->page_vaddr;
-                        *region_len = r->length;
-
                         struct slist_ref *next_ref = slist_next(&r->list);
                         if (NULL != next_ref) {
                                 struct region *next = region_of(next_ref);
 
-                                if (REGION_RES_STATE_FREE == next->resource.state) {
+                                if (region_is_free(next)) {
                                         r->length += next->length;
                                         slist_remove_next(&r->list);
-                                        kmm_cache_free(&REGIONS_CACHE, r);
+                                        kmm_cache_free(&REGIONS_CACHE, next);
                                 }
                         }
 
@@ -142,14 +158,19 @@ static void *register_resource(struct vm_area *area, void *arg)
 
         new->resource.ptr = res;
 
+        enum vm_flags flags = area->flags;
+        if (RESOURCE_BUFFER_FRAMEBUFFER == res->data.dev_buffer.kind) {
+                /* Nobody reads framebuffers back, so there is no need to order every store. */
+                flags = (flags & ~VM_CACHE_OFF) | VM_WRITE_COMBINE;
+        }
+
         uintptr_t const pbase = align_rounddown(res_start, PLATFORM_PAGE_SIZE);
         uintptr_t const vbase = align_rounddown((uintptr_t) new->page_vaddr, PLATFORM_PAGE_SIZE);
         for (size_t i = 0; i < pages; i++) {
                 uintptr_t const phys_addr = pbase + i * PLATFORM_PAGE_SIZE;
                 uintptr_t const virt_addr = vbase + i * PLATFORM_PAGE_SIZE;
 
-                vm_arch_pt_map(area->owner->root_dir, (void *)phys_addr, (void *)virt_addr,
-                               area->flags);
+                vm_arch_pt_map(area->owner->root_dir, (void *)phys_addr, (void *)virt_addr, flags);
         }
 
         return (new->page_vaddr);
@@ -164,10 +185,104 @@ static void unregister_resource(struct vm_area *area, void *arg)
         free_region_for(area, res, &reg_base, &reg_len);
 
         size_t const pages = div_ceil(reg_len, PLATFORM_PAGE_SIZE);
-        for (size_t i = 0; i < pages; i++) {
-                void *vaddr = (void*)((uintptr_t)reg_base + i * PLATFORM_PAGE_SIZE);
+        vm_arch_pt_unmap_range(area->owner->root_dir, reg_base, pages);
+}
+
+static struct region *last_region(struct vm_area *area)
+{
+        struct region *last = NULL;
+        SLIST_FOREACH (it, area->data) {
+                last = region_of(it);
+        }
+        kassert(last != NULL);
+        return (last);
+}
+
+/* Append regions of the next area to the area. */
+static bool merge_areas(struct vm_area *area, struct vm_area *next, struct slist_ref *garbage)
+{
+        struct region *last = last_region(area);
+        struct region *first = region_of(next->data);
+
+        kassert((uintptr_t)last->page_vaddr + last->length == (uintptr_t)first->page_vaddr);
+
+        if (region_is_free(last) && region_is_free(first)) {
+                last->length += first->length;
+                last->list.next = slist_next(&first->list);
+                slist_init(&first->list);
+                slist_insert(garbage, &first->list);
+        } else {
+                last->list.next = &first->list;
+        }
 
-                vm_arch_pt_unmap(area->owner->root_dir, vaddr);
+        next->data = NULL;
+        return (true);
+}
+
+/* A free region may need to be cut in two, so keep a spare one for the tail. */
+static bool split_prepare(struct vm_area *area __unused, struct vm_area *tail)
+{
+        struct region *spare = kmm_cache_alloc(&REGIONS_CACHE);
+        if (__unlikely(NULL == spare)) {
+                return (false);
+        }
+
+        slist_init(&spare->list);
+        tail->data = &spare->list;
+        return (true);
+}
+
+/* Move regions that are located after the tail's base to the tail.
+ * Occupied regions can't be cut in half. */
+static bool split_area(struct vm_area *area, struct vm_area *tail, struct slist_ref *garbage)
+{
+        uintptr_t const boundary = (uintptr_t)tail->base;
+        struct region *upper = region_of(tail->data);
+        tail->data = NULL;
+
+        struct region *prev = NULL;
+        SLIST_FOREACH (it, area->data) {
+                struct region *r = region_of(it);
+                uintptr_t const r_start = (uintptr_t)r->page_vaddr;
+                uintptr_t const r_end = r_start + r->length;
+
+                if (boundary == r_start) {
+                        kassert(prev != NULL);
+                        slist_init(&prev->list);
+                        tail->data = &r->list;
+                        break;
+                }
+
+                if (boundary > r_start && boundary < r_end) {
+                        if (!region_is_free(r)) {
+                                break;
+                        }
+
+                        upper->page_vaddr = (void *)boundary;
+                        upper->length = r_end - boundary;
+                        region_set_free(upper);
+                        upper->list.next = slist_next(&r->list);
+
+                        r->length = boundary - r_start;
+                        slist_init(&r->list);
+                        tail->data = &upper->list;
+                        return (true);
+                }
+
+                prev = r;
+        }
+
+        /* The spare region isn't needed. */
+        slist_insert(garbage, &upper->list);
+        return (tail->data != NULL);
+}
+
+static void release_regions(struct slist_ref *garbage)
+{
+        while (!slist_is_empty(garbage)) {
+                struct region *r = region_of(slist_next(garbage));
+                slist_remove_next(garbage);
+                kmm_cache_free(&REGIONS_CACHE, r);
         }
 }
 
@@ -175,6 +290,10 @@ static struct vm_area_ops DEV_AREA_OPS = {
         .handle_pg_fault = vm_pgfault_handle_panic,
         .register_map = register_resource,
         .unregister_map = unregister_resource,
+        .merge = merge_areas,
+        .split_prepare = split_prepare,
+        .split = split_area,
+        .release = release_regions,
 };
 
 struct vm_area *dev_area_new(struct vm_space *owner, size_t min_len)
@@ -194,12 +313,13 @@ struct vm_area *dev_area_new(struct vm_space *owner, size_t min_len)
         slist_init(&m->list);
         m->page_vaddr = area->base;
         m->length = area->length;
-        m->resource.state = REGION_RES_STATE_FREE;
+        region_set_free(m);
 
         /* Data contains an address of the first region. */
         area->data = &m->list;
 
-        return (area);
+        /* Adjacent dev areas are managed as a single one. */
+        return (vm_merge_area(area));
 }
 
 void kdev_init(struct vm_space *kernel_space)
@@ -50,7 +50,8 @@ void kmalloc_init(uint8_t lowest_pow2_size, uint8_t max_pow2_size)
                 obj_size += (1 << (i + lowest_pow2_size));
 
                 KMALLOC_CACHES[i] =
-                        kmm_cache_create(heap_name, obj_size, alignof(max_align_t), 0, NULL, NULL);
+                        kmm_cache_create(heap_name, obj_size, alignof(max_align_t),
+                                         KMM_CACHE_MERGEABLE, NULL, NULL);
         }
 }
 
@@ -1,6 +1,10 @@
 #include "kernel/mm/kmm.h"
 
+#include "kernel/config.h"
+#include "kernel/deferred.h"
+#include "kernel/kernel.h"
 #include "kernel/klog.h"
+#include "kernel/mm/shrinker.h"
 #include "kernel/platform_consts.h"
 
 #include "lib/align.h"
@@ -8,6 +12,7 @@
 #include "lib/cstd/assert.h"
 #include "lib/cstd/string.h"
 #include "lib/ds/slist.h"
+#include "lib/sync/spinlock.h"
 #include "lib/utils.h"
 
 #include <stdbool.h>
@@ -17,69 +22,8 @@
 static alloc_page_fn_t ALLOC_PAGE_FN;
 static free_page_fn_t FREE_PAGE_FN;
 
-/**
- *  Buffer control block for small objects (< PAGE_SIZE / 8).
- *  It's stored at the end of the buffer it manages.
- */
-struct bufctl_small {
-        struct slist_ref slist;
-};
-
-struct bufctl_large {
-        struct slist_ref slist;
-        void *memory;
-};
-
-union bufctl {
-        struct slist_ref slist;
-        struct bufctl_small small;
-        struct bufctl_large large;
-};
-
-/**
- * Returns an address of a memory block that is owned by a small bufctl.
- */
-static void *bufctl_small_get_mem(struct bufctl_small *ctl, struct kmm_cache *cache)
-{
-        uintptr_t ctl_addr = (uintptr_t)ctl;
-        uintptr_t buffer_addr = ctl_addr - cache->size;
-        buffer_addr = align_rounddown(buffer_addr, cache->alignment);
-        return ((void *)buffer_addr);
-}
-
-/**
- * Returns an address of a memory block that is owned by a large bufctl.
- */
-static void *bufctl_large_get_mem(struct bufctl_large *ctl)
-{
-        return (ctl->memory);
-}
-
-/**
- * Returns an address of a memory block owned by a bufctl.
- */
-static void *bufctl_mem(union bufctl *ctl, struct kmm_cache *cache)
-{
-        if (cache->flags & KMM_CACHE_LARGE) {
-                return (bufctl_large_get_mem(&ctl->large));
-        }
-        return (bufctl_small_get_mem(&ctl->small, cache));
-}
-
-/**
- * Returns an address of a small bufctl that owns given buffer.
- */
-static struct bufctl_small *get_bufctl_small(void *buffer, struct kmm_cache *cache)
-{
-        uintptr_t b = (uintptr_t)buffer;
-        b += cache->size;
-        b = align_roundup(b, sizeof(struct bufctl_small));
-
-        struct bufctl_small *s = (struct bufctl_small *)b;
-        kassert(properly_aligned(s));
-
-        return (s);
-}
+/* A large object takes at least PAGE_SIZE / 8, so a slab can't hold more of them. */
+#define LARGE_SLAB_MAX_OBJECTS (8U)
 
 /**
  * The structure of every used page.
@@ -93,21 +37,48 @@ struct page {
 
 struct kmm_slab {
         struct slist_ref slabs_list;
-        struct slist_ref free_buffers;
 
+        void *objects; /**< Address of the first object. */
+        size_t carved; /**< Objects [carved, slab_capacity) have never been handed out. */
         struct page *page;
         size_t objects_inuse;
+        size_t emptied_at; /**< The reap epoch when the slab became empty. */
+
+        /* A stack of indices of the objects that were handed out and then freed.
+         * A small slab has slab_capacity entries right after the header,
+         * a large one has LARGE_SLAB_MAX_OBJECTS. */
+        size_t free_count;
+        uint16_t free[];
+};
+
+/**
+ * A stack of constructed objects.
+ */
+struct kmm_magazine {
+        struct slist_ref depot_list;
+        size_t put_at; /**< The reap epoch when the magazine was put into the depot. */
+        size_t rounds;
+        void *objs[CONF_KMM_MAGAZINE_SIZE];
 };
 
 static struct {
         struct kmm_cache caches;
-        struct kmm_cache large_bufctls;
         struct kmm_cache slabs;
+        struct kmm_cache magazines;
 } CACHES;
 
+static void slab_free(struct kmm_cache *cache, void *mem);
+static void depot_drain(struct kmm_cache *cache);
+static void depot_age(struct kmm_cache *cache);
+static void cpu_cache_drain(struct kmm_cache *cache, struct kmm_cpu_cache *cc);
+
 /* Used to find empty memory slabs. */
 static struct slist_ref ALLOCATED_CACHES_HEAD;
 
+/* Reap intervals that have passed, and those that haven't been processed yet. */
+static size_t REAP_EPOCH;
+static size_t REAP_PENDING;
+
 static void page_free(struct page *p)
 {
         kassert(p);
@@ -134,26 +105,9 @@ static struct page *page_alloc(struct kmm_cache *cache __unused)
         return (page);
 }
 
-static void free_large_buffers(struct slist_ref *list_head, struct kmm_cache *cache)
+static void *slab_object_mem(struct kmm_slab *slab, struct kmm_cache *cache, size_t ndx)
 {
-        kassert(list_head != NULL);
-        kassert(cache != NULL);
-
-        /* Can't use SLIST_FOREACH 'cause it would use a slab after freeing. */
-        struct slist_ref *next = NULL;
-        struct slist_ref *current = slist_next(list_head);
-        while (current != NULL) {
-                union bufctl *b = container_of(current, union bufctl, slist);
-                next = slist_next(current);
-
-                if (cache->dtor) {
-                        void *mem = bufctl_large_get_mem(&b->large);
-                        cache->dtor(mem);
-                }
-                kmm_cache_free(&CACHES.large_bufctls, b);
-
-                current = next;
-        }
+        return ((void *)((uintptr_t)slab->objects + ndx * cache->stride));
 }
 
 static void slab_destroy(struct kmm_slab *slab, struct kmm_cache *cache)
@@ -166,16 +120,15 @@ static void slab_destroy(struct kmm_slab *slab, struct kmm_cache *cache)
                        slab->objects_inuse);
         }
 
-        if (cache->flags & KMM_CACHE_LARGE) {
-                free_large_buffers(&slab->free_buffers, cache);
-                kmm_cache_free(&CACHES.slabs, slab);
-        } else {
-                if (cache->dtor) {
-                        SLIST_FOREACH (it, slist_next(&slab->free_buffers)) {
-                                union bufctl *b = container_of(it, union bufctl, slist);
-                                void *mem = bufctl_small_get_mem(&b->small, cache);
-                                cache->dtor(mem);
-                        }
+        if (cache->dtor) {
+                for (size_t i = 0; i < slab->free_count; i++) {
+                        cache->dtor(slab_object_mem(slab, cache, slab->free[i]));
+                }
+        }
+        /* Objects that have never been handed out are constructed only if the cache isn't lazy. */
+        if (cache->dtor && !(cache->flags & KMM_CACHE_LAZY_CTOR)) {
+                for (size_t i = slab->carved; i < cache->slab_capacity; i++) {
+                        cache->dtor(slab_object_mem(slab, cache, i));
                 }
         }
 
@@ -187,7 +140,15 @@ static void slab_destroy(struct kmm_slab *slab, struct kmm_cache *cache)
                 slist_remove(&cache->slabs_partial, &slab->slabs_list);
         }
 
-        page_free(slab->page);
+        struct page *page = slab->page;
+        if (cache->flags & KMM_CACHE_LARGE) {
+                /* Large slabs live outside of their pages. */
+                kmm_cache_free(&CACHES.slabs, slab);
+        }
+        page_free(page);
+
+        cache->stats.shrinks++;
+        cache->stats.active_slabs--;
 }
 
 static void free_slabs_list(struct slist_ref *list_head, struct kmm_cache *from_cache)
@@ -209,7 +170,85 @@ static void free_slabs_list(struct slist_ref *list_head, struct kmm_cache *from_
 void kmm_cache_trim(struct kmm_cache *cache)
 {
         kassert(cache != NULL);
+        if (cache->merged_into != NULL) {
+                cache = cache->merged_into;
+        }
+
+        cache->busy++;
+        /* Magazines of other CPUs are theirs to drain. */
+        cpu_cache_drain(cache, &cache->cpus[kernel_arch_get_cpu_id()]);
+        depot_drain(cache);
         free_slabs_list(&cache->slabs_empty, cache);
+        cache->busy--;
+}
+
+static void reap_deferred(void)
+{
+        kmm_reap();
+}
+
+/* An idle system doesn't grow caches, so the reap doesn't wait for that. */
+static struct deferred_work REAP_WORK = {
+        .name = "kmm_reap",
+        .fn = reap_deferred,
+};
+
+void kmm_reap_tick(void)
+{
+        __atomic_add_fetch(&REAP_PENDING, 1, __ATOMIC_RELAXED);
+        deferred_schedule(&REAP_WORK);
+}
+
+/* Empty slabs are inserted at the head of the list, so the older ones are closer to the tail.
+ * Most of the objects of an idle cache sit in the depot, so the old magazines are flushed first.
+ * The slabs they empty are reaped once they get old too. */
+static size_t reap_cache(struct kmm_cache *cache, size_t limit)
+{
+        if (cache->busy > 0) {
+                return (0);
+        }
+
+        cache->busy++;
+        depot_age(cache);
+        cache->busy--;
+
+        struct slist_ref *current = slist_next(&cache->slabs_empty);
+        while (current != NULL) {
+                struct kmm_slab *slab = container_of(current, struct kmm_slab, slabs_list);
+                if (REAP_EPOCH - slab->emptied_at >= CONF_KMM_REAP_AGE) {
+                        break;
+                }
+                current = slist_next(current);
+        }
+
+        size_t freed = 0;
+        cache->busy++;
+        while (current != NULL && freed < limit) {
+                struct slist_ref *next = slist_next(current);
+                slab_destroy(container_of(current, struct kmm_slab, slabs_list), cache);
+                freed++;
+                current = next;
+        }
+        cache->busy--;
+
+        return (freed);
+}
+
+size_t kmm_reap(void)
+{
+        size_t const ticks = __atomic_exchange_n(&REAP_PENDING, 0, __ATOMIC_RELAXED);
+        REAP_EPOCH += ticks;
+
+        size_t freed = 0;
+        SLIST_FOREACH (it, slist_next(&ALLOCATED_CACHES_HEAD)) {
+                if (freed == CONF_KMM_REAP_BATCH) {
+                        break;
+                }
+                struct kmm_cache *c = container_of(it, struct kmm_cache, sys_caches);
+                freed += reap_cache(c, CONF_KMM_REAP_BATCH - freed);
+        }
+
+        return (freed);
 }
 
 void kmm_cache_trim_all(void)
@@ -220,6 +259,71 @@ void kmm_cache_trim_all(void)
         }
 }
 
+/* Every slab takes a single page, so the shrinker counts in pages.
+ * Full magazines of the depots are counted too: draining them may empty some slabs.
+ * The shrinker may run from a page fault in the middle of a cache operation, so the busy caches
+ * are skipped. */
+static size_t shrinker_count(struct shrinker *s __unused)
+{
+        size_t empty = 0;
+        SLIST_FOREACH (it, slist_next(&ALLOCATED_CACHES_HEAD)) {
+                struct kmm_cache *c = container_of(it, struct kmm_cache, sys_caches);
+                if (c->busy > 0) {
+                        continue;
+                }
+                SLIST_FOREACH (slab_it, slist_next(&c->slabs_empty)) {
+                        empty++;
+                }
+                SLIST_FOREACH (mag_it, slist_next(&c->depot_full)) {
+                        empty++;
+                }
+        }
+        return (empty);
+}
+
+/* Take one empty slab from every cache in turn, so no cache loses all of them at once. */
+static size_t shrinker_scan(struct shrinker *s __unused, size_t nr)
+{
+        SLIST_FOREACH (it, slist_next(&ALLOCATED_CACHES_HEAD)) {
+                struct kmm_cache *c = container_of(it, struct kmm_cache, sys_caches);
+                if (c->busy > 0) {
+                        continue;
+                }
+                c->busy++;
+                depot_drain(c);
+                c->busy--;
+        }
+
+        size_t freed = 0;
+        bool progress = true;
+        while (freed < nr && progress) {
+                progress = false;
+                SLIST_FOREACH (it, slist_next(&ALLOCATED_CACHES_HEAD)) {
+                        struct kmm_cache *c = container_of(it, struct kmm_cache, sys_caches);
+                        struct slist_ref *first = slist_next(&c->slabs_empty);
+                        if (first == NULL || c->busy > 0) {
+                                continue;
+                        }
+
+                        c->busy++;
+                        slab_destroy(container_of(first, struct kmm_slab, slabs_list), c);
+                        c->busy--;
+                        progress = true;
+                        if (++freed == nr) {
+                                break;
+                        }
+                }
+        }
+        return (freed);
+}
+
+static struct shrinker KMM_SHRINKER = {
+        .name = "kmm",
+        .count = shrinker_count,
+        .scan = shrinker_scan,
+        .seeks = 1,
+};
+
 /**
  * Returns page structure that contains an address.
  */
@@ -242,6 +346,37 @@ static struct kmm_slab *slab_get_by_addr(void *addr)
         return (page_get_by_addr(addr)->owner);
 }
 
+/**
+ * Returns an offset of the first object from the beginning of a slab's page.
+ * Small slabs keep their header and the stack of free indices there.
+ */
+static size_t cache_objects_offset(struct kmm_cache const *cache, size_t capacity)
+{
+        kassert(cache);
+
+        /* struct page is always stored at the beginning of the page. */
+        size_t offset = sizeof(struct page);
+        if (!(cache->flags & KMM_CACHE_LARGE)) {
+                offset += sizeof(struct kmm_slab) + capacity * sizeof(uint16_t);
+        }
+
+        return (align_roundup(offset, cache->alignment));
+}
+
+/**
+ * Runs the constructor on every object of a new slab unless the cache constructs objects lazily.
+ */
+static void slab_construct(struct kmm_slab *slab, struct kmm_cache *cache)
+{
+        if (cache->ctor == NULL || (cache->flags & KMM_CACHE_LAZY_CTOR)) {
+                return;
+        }
+
+        for (size_t i = 0; i < cache->slab_capacity; i++) {
+                cache->ctor(slab_object_mem(slab, cache, i));
+        }
+}
+
 static struct kmm_slab *slab_create_small(struct kmm_cache *cache, size_t const colour)
 {
         kassert(cache);
@@ -251,41 +386,24 @@ static struct kmm_slab *slab_create_small(struct kmm_cache *cache, size_t const
                 return (NULL);
         }
 
-        uintptr_t cursor = (uintptr_t)page->data;
-
-        struct kmm_slab *slab = (void *)cursor;
+        struct kmm_slab *slab = (void *)page->data;
         kassert(properly_aligned(slab));
 
-        cursor += sizeof(*slab);
+        uintptr_t cursor = (uintptr_t)page + cache_objects_offset(cache, cache->slab_capacity);
         cursor += colour;
-        cursor = align_roundup(cursor, cache->alignment);
 
         page->owner = slab;
 
         slab->objects_inuse = 0;
         slab->page = page;
+        slab->objects = (void *)cursor;
+        slab->carved = 0;
+        slab->free_count = 0;
         slist_init(&slab->slabs_list);
-        slist_init(&slab->free_buffers);
-
-        kassert(({
-                uintptr_t const page_end = (uintptr_t)page + PLATFORM_PAGE_SIZE;
-                uintptr_t const slab_elems_end = cursor + cache->slab_capacity * cache->stride;
-                /* Check that leftover space is less than a full stride. */
-                (page_end - slab_elems_end < cache->stride);
-        }));
-        for (size_t i = 0; i < cache->slab_capacity; i++, cursor += cache->stride) {
-                void *buffer = (void *)cursor;
-                struct bufctl_small *ctl = get_bufctl_small(buffer, cache);
-                kassert((uintptr_t)ctl < cursor + cache->stride);
-
-                slist_init(&ctl->slist);
-                slist_insert(&slab->free_buffers, &ctl->slist);
-
-                void *mem = bufctl_small_get_mem(ctl, cache);
-                if (cache->ctor) {
-                        cache->ctor(mem);
-                }
-        }
+
+        kassert(cursor + cache->slab_capacity * cache->stride <=
+                (uintptr_t)page + PLATFORM_PAGE_SIZE);
+        slab_construct(slab, cache);
 
         return (slab);
 }
@@ -305,26 +423,17 @@ static struct kmm_slab *slab_create_large(struct kmm_cache *cache, size_t const
         }
         page->owner = slab;
 
-        uintptr_t obj_addr = (uintptr_t)page->data;
+        uintptr_t obj_addr = (uintptr_t)page + cache_objects_offset(cache, cache->slab_capacity);
         obj_addr += colour;
-        obj_addr = align_roundup(obj_addr, cache->alignment);
 
         slab->objects_inuse = 0;
         slab->page = page;
+        slab->objects = (void *)obj_addr;
+        slab->carved = 0;
+        slab->free_count = 0;
         slist_init(&slab->slabs_list);
-        slist_init(&slab->free_buffers);
-
-        for (size_t i = 0; i < cache->slab_capacity; i++, obj_addr += cache->stride) {
-                struct bufctl_large *ctl = kmm_cache_alloc(&CACHES.large_bufctls);
-                slist_init(&ctl->slist);
-                slist_insert(&slab->free_buffers, &ctl->slist);
 
-                void *obj = (void *)obj_addr;
-                ctl->memory = obj;
-                if (cache->ctor) {
-                        cache->ctor(obj);
-                }
-        }
+        slab_construct(slab, cache);
 
         return (slab);
 
@@ -338,27 +447,29 @@ static void object_free(void *mem, struct kmm_slab *slab, struct kmm_cache *cach
         kassert(mem);
         kassert(slab);
 
+        uintptr_t const offset = (uintptr_t)mem - (uintptr_t)slab->objects;
+        size_t const ndx = offset / cache->stride;
+        kassert(offset % cache->stride == 0 && ndx < slab->carved);
+        kassert(slab->free_count < cache->slab_capacity);
+
+        slab->free[slab->free_count++] = (uint16_t)ndx;
         slab->objects_inuse--;
-        union bufctl *ctl;
-        if (cache->flags & KMM_CACHE_LARGE) {
-                ctl = kmm_cache_alloc(&CACHES.large_bufctls);
-                ctl->large.memory = mem;
-        } else {
-                ctl = (union bufctl *)get_bufctl_small(mem, cache);
-        }
-        slist_insert(&slab->free_buffers, &ctl->slist);
 }
 
 static void *object_alloc(struct kmm_slab *slab, struct kmm_cache *cache)
 {
         kassert(slab);
-        kassert(!slist_is_empty(&slab->free_buffers));
 
-        union bufctl *free_ctl = container_of(slist_next(&slab->free_buffers), union bufctl, slist);
-        slist_remove(&slab->free_buffers, &free_ctl->slist);
-        void *mem = bufctl_mem(free_ctl, cache);
-        if (cache->flags & KMM_CACHE_LARGE) {
-                kmm_cache_free(&CACHES.large_bufctls, free_ctl);
+        void *mem = NULL;
+        if (slab->free_count > 0) {
+                mem = slab_object_mem(slab, cache, slab->free[--slab->free_count]);
+        } else {
+                /* Nothing has been freed yet. Take the next object that was never used. */
+                kassert(slab->carved < cache->slab_capacity);
+                mem = slab_object_mem(slab, cache, slab->carved++);
+                if (cache->ctor && (cache->flags & KMM_CACHE_LAZY_CTOR)) {
+                        cache->ctor(mem);
+                }
         }
 
         slab->objects_inuse++;
@@ -366,39 +477,42 @@ static void *object_alloc(struct kmm_slab *slab, struct kmm_cache *cache)
         return (mem);
 }
 
-static size_t cache_get_avail_space(struct kmm_cache *cache)
+static size_t cache_get_capacity(struct kmm_cache *cache)
 {
         kassert(cache);
         kassert(cache->stride > 0);
 
-        /* struct page is always stored at the beginning of the page. */
-        size_t avail_space = PLATFORM_PAGE_SIZE - sizeof(struct page);
+        size_t per_object = cache->stride;
         if (!(cache->flags & KMM_CACHE_LARGE)) {
-                avail_space -= sizeof(struct kmm_slab);
+                per_object += sizeof(uint16_t);
         }
+        size_t capacity = (PLATFORM_PAGE_SIZE - cache_objects_offset(cache, 0)) / per_object;
 
-        return (avail_space);
-}
-
-static size_t cache_get_capacity(struct kmm_cache *cache)
-{
-        kassert(cache);
-        kassert(cache->stride > 0);
+        /* Aligning the first object may take a few more bytes. */
+        while (capacity > 0) {
+                size_t const end = cache_objects_offset(cache, capacity) + capacity * cache->stride;
+                if (end <= PLATFORM_PAGE_SIZE) {
+                        break;
+                }
+                capacity--;
+        }
 
-        return (cache_get_avail_space(cache) / cache->stride);
+        return (capacity);
 }
 
-static size_t cache_get_wasted(struct kmm_cache *cache)
+static size_t cache_get_wasted(struct kmm_cache const *cache)
 {
         kassert(cache);
         kassert(cache->slab_capacity > 0);
         kassert(cache->stride > 0);
 
-        return (cache_get_avail_space(cache) - cache->slab_capacity * cache->stride);
+        size_t const used = cache_objects_offset(cache, cache->slab_capacity) +
+                            cache->slab_capacity * cache->stride;
+        return (PLATFORM_PAGE_SIZE - used);
 }
 
-void kmm_cache_init(struct kmm_cache *restrict cache, const char *name, size_t size, size_t align,
-                    unsigned flags, void (*ctor)(void *), void (*dtor)(void *))
+static void cache_setup(struct kmm_cache *restrict cache, const char *name, size_t size,
+                        size_t align, unsigned flags, void (*ctor)(void *), void (*dtor)(void *))
 {
         kassert(cache);
 
@@ -410,18 +524,19 @@ void kmm_cache_init(struct kmm_cache *restrict cache, const char *name, size_t s
         bool large = cache->size >= (PLATFORM_PAGE_SIZE / 8);
         cache->flags |= large ? KMM_CACHE_LARGE : 0;
 
-        size_t obj_space = cache->size;
         if (!large) {
-                obj_space += sizeof(struct bufctl_small);
-                cache->alignment = MAX(sizeof(struct bufctl_small), cache->alignment);
+                /* Small objects that don't ask for an alignment still get the pointer one. */
+                cache->alignment = MAX(sizeof(void *), cache->alignment);
         }
 
         if (cache->alignment != 0) {
-                cache->stride = align_roundup(obj_space, cache->alignment);
+                cache->stride = align_roundup(cache->size, cache->alignment);
         } else {
-                cache->stride = obj_space;
+                cache->stride = cache->size;
         }
         cache->slab_capacity = cache_get_capacity(cache);
+        kassert(cache->slab_capacity > 0 && cache->slab_capacity <= UINT16_MAX);
+        kassert(!large || cache->slab_capacity <= LARGE_SLAB_MAX_OBJECTS);
 
         cache->colour_max = cache_get_wasted(cache);
         cache->colour_off = cache->alignment;
@@ -432,13 +547,117 @@ void kmm_cache_init(struct kmm_cache *restrict cache, const char *name, size_t s
         slist_init(&cache->slabs_empty);
         slist_init(&cache->slabs_partial);
         slist_init(&cache->slabs_full);
+
+        for (size_t i = 0; i < ARRAY_SIZE(cache->cpus); i++) {
+                cache->cpus[i].loaded = NULL;
+                cache->cpus[i].previous = NULL;
+        }
+        spinlock_init(&cache->depot_lock);
+        slist_init(&cache->depot_full);
+        slist_init(&cache->depot_empty);
+
+        kmemset(&cache->stats, 0, sizeof(cache->stats));
+        cache->busy = 0;
+        cache->merged_into = NULL;
+        cache->merged_users = 0;
+}
+
+size_t kmm_cache_wasted(struct kmm_cache const *cache)
+{
+        kassert(cache != NULL);
+
+        return (cache->stats.active_slabs * cache_get_wasted(cache));
+}
+
+void kmm_dump_stats(void)
+{
+        LOGF_I("%-24s %8s %8s %8s %8s %8s %8s %8s %8s %8s %8s\n", "name", "active", "objs",
+               "objsize", "perslab", "slabs", "allocs", "frees", "grows", "shrinks", "wasted");
+
+        SLIST_FOREACH (it, slist_next(&ALLOCATED_CACHES_HEAD)) {
+                struct kmm_cache *c = container_of(it, struct kmm_cache, sys_caches);
+                struct kmm_cache_stats const *s = &c->stats;
+
+                LOGF_I("%-24s %8zu %8zu %8zu %8zu %8zu %8zu %8zu %8zu %8zu %8zu\n", c->name,
+                       s->active_objects, s->active_slabs * c->slab_capacity, c->size,
+                       c->slab_capacity, s->active_slabs, s->allocs, s->frees, s->grows,
+                       s->shrinks, kmm_cache_wasted(c));
+        }
 }
 
 static void kmm_cache_register(struct kmm_cache *cache)
 {
+        /* Static caches may be initialized again, e.g. when their subsystem is. */
+        SLIST_FOREACH (it, slist_next(&ALLOCATED_CACHES_HEAD)) {
+                if (it == &cache->sys_caches) {
+                        return;
+                }
+        }
+
         slist_insert(&ALLOCATED_CACHES_HEAD, &cache->sys_caches);
 }
 
+/* Shared caches take the flags of their users, but never merge themselves. */
+static bool cache_can_merge(struct kmm_cache *cache)
+{
+        return ((cache->flags & KMM_CACHE_MERGEABLE) && cache->ctor == NULL &&
+                cache->dtor == NULL && cache->merged_into == NULL && cache->merged_users == 0);
+}
+
+/**
+ * Finds or creates a shared cache that can hold the objects of the given cache.
+ */
+static struct kmm_cache *get_merge_target(struct kmm_cache *cache)
+{
+        SLIST_FOREACH (it, slist_next(&ALLOCATED_CACHES_HEAD)) {
+                struct kmm_cache *c = container_of(it, struct kmm_cache, sys_caches);
+                bool const compatible = c->stride == cache->stride &&
+                                        c->alignment == cache->alignment &&
+                                        c->flags == cache->flags;
+                if (c->merged_users > 0 && compatible) {
+                        return (c);
+                }
+        }
+
+        struct kmm_cache *shared = kmm_cache_alloc(&CACHES.caches);
+        if (__unlikely(shared == NULL)) {
+                return (NULL);
+        }
+        cache_setup(shared, "kmm_merged", cache->size, cache->alignment, cache->flags, NULL, NULL);
+        kmm_cache_register(shared);
+
+        return (shared);
+}
+
+/* If no shared cache can be had, the cache simply keeps its own slabs. */
+static void cache_try_merge(struct kmm_cache *cache)
+{
+        if (!cache_can_merge(cache)) {
+                return;
+        }
+
+        struct kmm_cache *shared = get_merge_target(cache);
+        if (__unlikely(shared == NULL)) {
+                return;
+        }
+        /* Objects of every user fit the stride. Keep the largest size for statistics. */
+        shared->size = MAX(shared->size, cache->size);
+        shared->merged_users++;
+        cache->merged_into = shared;
+}
+
+void kmm_cache_init(struct kmm_cache *restrict cache, const char *name, size_t size, size_t align,
+                    unsigned flags, void (*ctor)(void *), void (*dtor)(void *))
+{
+        cache_setup(cache, name, size, align, flags, ctor, dtor);
+        /* Shared caches are allocated from a cache of the allocator. Before kmm_init() it isn't
+         * there, so kmm_init() merges such caches itself. */
+        if (ALLOC_PAGE_FN != NULL) {
+                cache_try_merge(cache);
+        }
+        kmm_cache_register(cache);
+}
+
 void kmm_init(alloc_page_fn_t alloc_page_fn, free_page_fn_t free_page_fn)
 {
         kassert(alloc_page_fn != NULL);
@@ -447,18 +666,28 @@ void kmm_init(alloc_page_fn_t alloc_page_fn, free_page_fn_t free_page_fn)
         ALLOC_PAGE_FN = alloc_page_fn;
         FREE_PAGE_FN = free_page_fn;
 
-        slist_init(&ALLOCATED_CACHES_HEAD);
+        /* Caches of the subsystems that come up earlier are registered already. */
+
+        /* The allocator's own objects can't be cached in magazines that are made of them. */
+        kmm_cache_init(&CACHES.caches, "slab_alloc_caches", sizeof(struct kmm_cache), 0,
+                       KMM_CACHE_NO_MAGAZINE, NULL, NULL);
+        /* Only large slabs are allocated from the cache. */
+        size_t const large_slab_size = sizeof(struct kmm_slab) +
+                                       LARGE_SLAB_MAX_OBJECTS * sizeof(uint16_t);
+        kmm_cache_init(&CACHES.slabs, "slab_alloc_slabs", large_slab_size, 0,
+                       KMM_CACHE_NO_MAGAZINE, NULL, NULL);
+        kmm_cache_init(&CACHES.magazines, "slab_alloc_magazines", sizeof(struct kmm_magazine), 0,
+                       KMM_CACHE_NO_MAGAZINE, NULL, NULL);
 
-        kmm_cache_register(&CACHES.caches);
-        kmm_cache_register(&CACHES.slabs);
-        kmm_cache_register(&CACHES.large_bufctls);
+        SLIST_FOREACH (it, slist_next(&ALLOCATED_CACHES_HEAD)) {
+                struct kmm_cache *c = container_of(it, struct kmm_cache, sys_caches);
+                if (c->stats.active_slabs == 0) {
+                        cache_try_merge(c);
+                }
+        }
 
-        kmm_cache_init(&CACHES.caches, "slab_alloc_caches", sizeof(struct kmm_cache), 0, 0, NULL,
-                       NULL);
-        kmm_cache_init(&CACHES.slabs, "slab_alloc_slabs", sizeof(struct kmm_slab), 0, 0, NULL,
-                       NULL);
-        kmm_cache_init(&CACHES.large_bufctls, "slab_alloc_bufctls", sizeof(struct bufctl_large), 0,
-                       0, NULL, NULL);
+        shrinker_register(&KMM_SHRINKER);
+        deferred_register(&REAP_WORK);
 }
 
 struct kmm_cache *kmm_cache_create(const char *name, size_t size, size_t align,
@@ -470,8 +699,6 @@ struct kmm_cache *kmm_cache_create(const char *name, size_t size, size_t align,
         }
         kmm_cache_init(cache, name, size, align, cache_flags, ctor, dtor);
 
-        kmm_cache_register(cache);
-
         return (cache);
 }
 
@@ -479,6 +706,26 @@ void kmm_cache_destroy(struct kmm_cache *cache)
 {
         kassert(cache);
 
+        struct kmm_cache *shared = cache->merged_into;
+        if (shared != NULL) {
+                if (cache->stats.active_objects > 0) {
+                        LOGF_W("Destroying %s cache with objects in use\n", cache->name);
+                }
+                slist_remove(&ALLOCATED_CACHES_HEAD, &cache->sys_caches);
+                kmm_cache_free(&CACHES.caches, cache);
+
+                kassert(shared->merged_users > 0);
+                if (--shared->merged_users == 0) {
+                        kmm_cache_destroy(shared);
+                }
+                return;
+        }
+
+        for (size_t i = 0; i < ARRAY_SIZE(cache->cpus); i++) {
+                cpu_cache_drain(cache, &cache->cpus[i]);
+        }
+        depot_drain(cache);
+
         if (!slist_is_empty(&cache->slabs_full)) {
                 LOGF_W("Freeing slab with objects in use from %s cache\n", cache->name);
                 free_slabs_list(&cache->slabs_full, cache);
@@ -522,6 +769,11 @@ static struct kmm_slab *get_new_slab(struct kmm_cache *cache)
 {
         kassert(cache != NULL);
 
+        /* Release idle slabs of other caches before taking another page. */
+        if (__atomic_load_n(&REAP_PENDING, __ATOMIC_RELAXED) > 0) {
+                kmm_reap();
+        }
+
         struct kmm_slab *slab = NULL;
         if (cache->flags & KMM_CACHE_LARGE) {
                 slab = slab_create_large(cache, cache->colour_next);
@@ -533,42 +785,80 @@ static struct kmm_slab *get_new_slab(struct kmm_cache *cache)
                 cache->colour_next = 0;
         }
 
-        if (__unlikely(slab == NULL)) {
-                return (NULL);
-        }
-
-        if (cache->slab_capacity == 1) {
-                slist_insert(&cache->slabs_full, &slab->slabs_list);
-        } else {
-                slist_insert(&cache->slabs_partial, &slab->slabs_list);
+        if (__likely(slab != NULL)) {
+                cache->stats.grows++;
+                cache->stats.active_slabs++;
         }
 
         return (slab);
 }
 
-void *kmm_cache_alloc(struct kmm_cache *cache)
+/**
+ * Returns the list the slab belongs to according to the number of objects in use.
+ */
+static struct slist_ref *slab_state_list(struct kmm_cache *cache, struct kmm_slab *slab)
 {
-        kassert(cache != NULL);
+        if (slab->objects_inuse == 0) {
+                return (&cache->slabs_empty);
+        } else if (slab->objects_inuse == cache->slab_capacity) {
+                return (&cache->slabs_full);
+        }
+        return (&cache->slabs_partial);
+}
 
+static void *slab_alloc(struct kmm_cache *cache)
+{
         struct kmm_slab *slab = find_existing_slab(cache);
-        if (slab == NULL) {
-                slab = get_new_slab(cache);
-                if (__unlikely(slab == NULL)) {
-                        return (NULL);
-                }
+        if (slab != NULL) {
+                return (object_alloc(slab, cache));
+        }
+
+        slab = get_new_slab(cache);
+        if (__unlikely(slab == NULL)) {
+                return (NULL);
         }
 
         void *obj = object_alloc(slab, cache);
         kassert(obj);
+        slist_insert(slab_state_list(cache, slab), &slab->slabs_list);
 
         return (obj);
 }
 
-void kmm_cache_free(struct kmm_cache *cache, void *mem)
+/**
+ * Takes up to n objects from the slabs. Each slab changes its list only once.
+ */
+static size_t slab_alloc_bulk(struct kmm_cache *cache, size_t n, void **out)
 {
-        kassert(cache);
-        kassert(mem);
+        size_t done = 0;
+        while (done < n) {
+                struct kmm_slab *slab = NULL;
+                struct slist_ref *list = &cache->slabs_partial;
+                if (slist_is_empty(list)) {
+                        list = &cache->slabs_empty;
+                }
+
+                if (!slist_is_empty(list)) {
+                        slab = container_of(slist_next(list), struct kmm_slab, slabs_list);
+                        slist_remove_next(list);
+                } else {
+                        slab = get_new_slab(cache);
+                        if (__unlikely(slab == NULL)) {
+                                break;
+                        }
+                }
 
+                while (done < n && slab->objects_inuse < cache->slab_capacity) {
+                        out[done++] = object_alloc(slab, cache);
+                }
+                slist_insert(slab_state_list(cache, slab), &slab->slabs_list);
+        }
+
+        return (done);
+}
+
+static void slab_free(struct kmm_cache *cache, void *mem)
+{
         struct kmm_slab *slab = slab_get_by_addr(mem);
         kassert(slab);
 
@@ -583,6 +873,7 @@ void kmm_cache_free(struct kmm_cache *cache, void *mem)
         }
 
         if (becomes_empty) {
+                slab->emptied_at = REAP_EPOCH;
                 slist_insert(&cache->slabs_empty, &slab->slabs_list);
         } else if (was_full) {
                 slist_insert(&cache->slabs_partial, &slab->slabs_list);
@@ -590,3 +881,308 @@ void kmm_cache_free(struct kmm_cache *cache, void *mem)
 
         object_free(mem, slab, cache);
 }
+
+/**
+ * Returns objects to their slabs. A run of objects from the same slab changes its list only once.
+ */
+static void slab_free_bulk(struct kmm_cache *cache, size_t n, void **objs)
+{
+        size_t i = 0;
+        while (i < n) {
+                struct kmm_slab *slab = slab_get_by_addr(objs[i]);
+                kassert(slab);
+                struct slist_ref *old_list = slab_state_list(cache, slab);
+
+                do {
+                        object_free(objs[i], slab, cache);
+                        i++;
+                } while (i < n && slab_get_by_addr(objs[i]) == slab);
+
+                struct slist_ref *new_list = slab_state_list(cache, slab);
+                if (new_list != old_list) {
+                        if (new_list == &cache->slabs_empty) {
+                                slab->emptied_at = REAP_EPOCH;
+                        }
+                        slist_remove(old_list, &slab->slabs_list);
+                        slist_insert(new_list, &slab->slabs_list);
+                }
+        }
+}
+
+static void magazine_flush(struct kmm_cache *cache, struct kmm_magazine *mag)
+{
+        while (mag->rounds > 0) {
+                slab_free(cache, mag->objs[--mag->rounds]);
+        }
+}
+
+/* Return the objects of the detached magazines to the slabs, and free the magazines. */
+static void magazines_release(struct kmm_cache *cache, struct slist_ref *list)
+{
+        while (!slist_is_empty(list)) {
+                struct slist_ref *first = slist_next(list);
+                slist_remove_next(list);
+
+                struct kmm_magazine *mag = container_of(first, struct kmm_magazine, depot_list);
+                magazine_flush(cache, mag);
+                kmm_cache_free(&CACHES.magazines, mag);
+        }
+}
+
+/* Return the objects of all magazines in the depot to the slabs. */
+static void depot_drain(struct kmm_cache *cache)
+{
+        struct slist_ref full;
+        struct slist_ref empty;
+
+        spinlock_lock(&cache->depot_lock);
+        full = cache->depot_full;
+        empty = cache->depot_empty;
+        slist_init(&cache->depot_full);
+        slist_init(&cache->depot_empty);
+        spinlock_unlock(&cache->depot_lock);
+
+        magazines_release(cache, &full);
+        magazines_release(cache, &empty);
+}
+
+/* Release the magazines that have stayed in the depot for CONF_KMM_REAP_AGE reap intervals.
+ * Magazines are put at the head of the lists, so the old ones make up their tails. */
+static void depot_age(struct kmm_cache *cache)
+{
+        struct slist_ref *lists[] = { &cache->depot_full, &cache->depot_empty };
+        struct slist_ref aged[ARRAY_SIZE(lists)];
+
+        spinlock_lock(&cache->depot_lock);
+        for (size_t i = 0; i < ARRAY_SIZE(lists); i++) {
+                slist_init(&aged[i]);
+
+                struct slist_ref *prev = lists[i];
+                while (slist_next(prev) != NULL) {
+                        struct kmm_magazine *mag = container_of(slist_next(prev),
+                                                                struct kmm_magazine, depot_list);
+                        if (REAP_EPOCH - mag->put_at >= CONF_KMM_REAP_AGE) {
+                                aged[i] = *prev;
+                                slist_init(prev);
+                                break;
+                        }
+                        prev = slist_next(prev);
+                }
+        }
+        spinlock_unlock(&cache->depot_lock);
+
+        for (size_t i = 0; i < ARRAY_SIZE(aged); i++) {
+                magazines_release(cache, &aged[i]);
+        }
+}
+
+static void depot_put(struct kmm_cache *cache, struct kmm_magazine *mag)
+{
+        slist_init(&mag->depot_list);
+        mag->put_at = REAP_EPOCH;
+
+        spinlock_lock(&cache->depot_lock);
+        struct slist_ref *list = mag->rounds > 0 ? &cache->depot_full : &cache->depot_empty;
+        slist_insert(list, &mag->depot_list);
+        spinlock_unlock(&cache->depot_lock);
+}
+
+static struct kmm_magazine *depot_get(struct kmm_cache *cache, bool full)
+{
+        struct kmm_magazine *mag = NULL;
+
+        spinlock_lock(&cache->depot_lock);
+        struct slist_ref *list = full ? &cache->depot_full : &cache->depot_empty;
+        struct slist_ref *first = slist_next(list);
+        if (first != NULL) {
+                slist_remove_next(list);
+                mag = container_of(first, struct kmm_magazine, depot_list);
+        }
+        spinlock_unlock(&cache->depot_lock);
+
+        return (mag);
+}
+
+static void cpu_cache_drain(struct kmm_cache *cache, struct kmm_cpu_cache *cc)
+{
+        struct kmm_magazine *mags[] = { cc->loaded, cc->previous };
+        for (size_t i = 0; i < ARRAY_SIZE(mags); i++) {
+                if (mags[i] != NULL) {
+                        magazine_flush(cache, mags[i]);
+                        kmm_cache_free(&CACHES.magazines, mags[i]);
+                }
+        }
+        cc->loaded = NULL;
+        cc->previous = NULL;
+}
+
+static bool magazine_is_empty(struct kmm_magazine *mag)
+{
+        return (mag == NULL || mag->rounds == 0);
+}
+
+static bool magazine_is_full(struct kmm_magazine *mag)
+{
+        return (mag == NULL || mag->rounds == CONF_KMM_MAGAZINE_SIZE);
+}
+
+static void swap_magazines(struct kmm_cpu_cache *cc)
+{
+        struct kmm_magazine *tmp = cc->loaded;
+        cc->loaded = cc->previous;
+        cc->previous = tmp;
+}
+
+static void *magazine_alloc(struct kmm_cache *cache, struct kmm_cpu_cache *cc)
+{
+        if (magazine_is_empty(cc->loaded)) {
+                if (!magazine_is_empty(cc->previous)) {
+                        swap_magazines(cc);
+                } else {
+                        struct kmm_magazine *full = depot_get(cache, true);
+                        if (full == NULL) {
+                                return (NULL);
+                        }
+                        if (cc->previous != NULL) {
+                                depot_put(cache, cc->previous);
+                        }
+                        cc->previous = cc->loaded;
+                        cc->loaded = full;
+                }
+        }
+
+        return (cc->loaded->objs[--cc->loaded->rounds]);
+}
+
+static bool magazine_free(struct kmm_cache *cache, struct kmm_cpu_cache *cc, void *mem)
+{
+        if (magazine_is_full(cc->loaded)) {
+                if (!magazine_is_full(cc->previous)) {
+                        swap_magazines(cc);
+                } else {
+                        struct kmm_magazine *empty = depot_get(cache, false);
+                        if (empty == NULL) {
+                                empty = kmm_cache_alloc(&CACHES.magazines);
+                                if (__unlikely(empty == NULL)) {
+                                        return (false);
+                                }
+                                empty->rounds = 0;
+                        }
+                        if (cc->previous != NULL) {
+                                depot_put(cache, cc->previous);
+                        }
+                        cc->previous = cc->loaded;
+                        cc->loaded = empty;
+                }
+        }
+
+        cc->loaded->objs[cc->loaded->rounds++] = mem;
+        return (true);
+}
+
+void *kmm_cache_alloc(struct kmm_cache *cache)
+{
+        kassert(cache != NULL);
+
+        cache->busy++;
+        void *obj = NULL;
+        if (cache->merged_into != NULL) {
+                obj = kmm_cache_alloc(cache->merged_into);
+        } else if (!(cache->flags & KMM_CACHE_NO_MAGAZINE)) {
+                struct kmm_cpu_cache *cc = &cache->cpus[kernel_arch_get_cpu_id()];
+                obj = magazine_alloc(cache, cc);
+        }
+        if (obj == NULL && cache->merged_into == NULL) {
+                obj = slab_alloc(cache);
+        }
+
+        if (__likely(obj != NULL)) {
+                cache->stats.allocs++;
+                cache->stats.active_objects++;
+        }
+        cache->busy--;
+
+        return (obj);
+}
+
+void kmm_cache_free(struct kmm_cache *cache, void *mem)
+{
+        kassert(cache);
+        kassert(mem);
+        kassert(cache->stats.active_objects > 0);
+
+        cache->stats.frees++;
+        cache->stats.active_objects--;
+
+        if (cache->merged_into != NULL) {
+                kmm_cache_free(cache->merged_into, mem);
+                return;
+        }
+
+        cache->busy++;
+        bool cached = false;
+        if (!(cache->flags & KMM_CACHE_NO_MAGAZINE)) {
+                struct kmm_cpu_cache *cc = &cache->cpus[kernel_arch_get_cpu_id()];
+                cached = magazine_free(cache, cc, mem);
+        }
+        if (!cached) {
+                slab_free(cache, mem);
+        }
+        cache->busy--;
+}
+
+bool kmm_cache_alloc_bulk(struct kmm_cache *cache, size_t n, void **out)
+{
+        kassert(cache != NULL);
+        kassert(out != NULL || n == 0);
+
+        if (cache->merged_into != NULL) {
+                if (__unlikely(!kmm_cache_alloc_bulk(cache->merged_into, n, out))) {
+                        return (false);
+                }
+                cache->stats.allocs += n;
+                cache->stats.active_objects += n;
+                return (true);
+        }
+
+        cache->busy++;
+        size_t done = 0;
+        if (!(cache->flags & KMM_CACHE_NO_MAGAZINE)) {
+                struct kmm_magazine *mag = cache->cpus[kernel_arch_get_cpu_id()].loaded;
+                while (done < n && !magazine_is_empty(mag)) {
+                        out[done++] = mag->objs[--mag->rounds];
+                }
+        }
+
+        done += slab_alloc_bulk(cache, n - done, &out[done]);
+        if (__unlikely(done < n)) {
+                slab_free_bulk(cache, done, out);
+                cache->busy--;
+                return (false);
+        }
+        cache->busy--;
+
+        cache->stats.allocs += n;
+        cache->stats.active_objects += n;
+
+        return (true);
+}
+
+void kmm_cache_free_bulk(struct kmm_cache *cache, size_t n, void **objs)
+{
+        kassert(cache != NULL);
+        kassert(objs != NULL || n == 0);
+        kassert(cache->stats.active_objects >= n);
+
+        cache->stats.frees += n;
+        cache->stats.active_objects -= n;
+
+        if (cache->merged_into != NULL) {
+                kmm_cache_free_bulk(cache->merged_into, n, objs);
+                return;
+        }
+
+        cache->busy++;
+        slab_free_bulk(cache, n, objs);
+        cache->busy--;
+}
@@ -1,10 +1,17 @@
 // UNITY_TEST DEPENDS ON: kernel/kernel/mm/kmm.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/deferred.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/shrinker.c
+// UNITY_TEST DEPENDS ON: kernel/lib/cstd/string/memset.c
 // UNITY_TEST DEPENDS ON: kernel/lib/ds/slist.c
 // UNITY_TEST DEPENDS ON: kernel/test_fakes/panic.c
 
+#include "kernel/deferred.h"
 #include "kernel/mm/kmm.h"
+#include "kernel/mm/shrinker.h"
 
+#include "lib/align.h"
 #include "lib/cppdefs.h"
+#include "lib/utils.h"
 
 #include <assert.h>
 #include <stddef.h>
@@ -250,6 +257,60 @@ static void destructor(void)
         TEST_ASSERT_MESSAGE(destroyed, "Destructor wasn't called.");
 }
 
+static size_t lazy_constructor__ctors = 0;
+static size_t lazy_constructor__dtors = 0;
+
+static void lazy_constructor__ctor(void *mem)
+{
+        constructor__ctor(mem);
+        lazy_constructor__ctors++;
+}
+
+static void lazy_constructor__dtor(void *mem __unused)
+{
+        lazy_constructor__dtors++;
+}
+
+static void lazy_constructor(void)
+{
+        lazy_constructor__ctors = 0;
+        lazy_constructor__dtors = 0;
+
+        size_t const sizes[] = { sizeof(struct constructor__type), 1024 };
+        for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+                struct kmm_cache *cache =
+                        kmm_cache_create("test_cache", sizes[i], 0, KMM_CACHE_LAZY_CTOR,
+                                         lazy_constructor__ctor, lazy_constructor__dtor);
+                TEST_ASSERT(cache);
+
+                /* Only the object that was handed out gets constructed. */
+                struct constructor__type *obj = kmm_cache_alloc(cache);
+                TEST_ASSERT(obj);
+                TEST_ASSERT_TRUE(cache->slab_capacity > 1);
+                TEST_ASSERT_EQUAL_size_t(1, lazy_constructor__ctors);
+                TEST_ASSERT_EQUAL_INT(constructor__foo, obj->foo);
+                TEST_ASSERT_EQUAL_PTR(obj, obj->pfoo);
+
+                /* A freed object stays constructed. */
+                kmm_cache_free(cache, obj);
+                kmm_cache_trim(cache);
+                TEST_ASSERT_EQUAL_size_t(1, lazy_constructor__dtors);
+
+                obj = kmm_cache_alloc(cache);
+                struct constructor__type *other = kmm_cache_alloc(cache);
+                TEST_ASSERT_TRUE(obj != other);
+                TEST_ASSERT_EQUAL_size_t(3, lazy_constructor__ctors);
+                kmm_cache_free(cache, obj);
+                kmm_cache_free(cache, other);
+
+                kmm_cache_destroy(cache);
+                TEST_ASSERT_EQUAL_size_t(3, lazy_constructor__dtors);
+
+                lazy_constructor__ctors = 0;
+                lazy_constructor__dtors = 0;
+        }
+}
+
 static void trimming(void)
 {
         typedef uint32_t elem_t;
@@ -347,6 +408,401 @@ static void cache_coloring(void)
         free(ptrs);
 }
 
+static void shrinking(void)
+{
+        struct kmm_cache *cache = kmm_cache_create("test_cache", 256, 0, 0, NULL, NULL);
+
+        void *objs[32];
+        for (size_t i = 0; i < ARRAY_SIZE(objs); i++) {
+                objs[i] = kmm_cache_alloc(cache);
+                TEST_ASSERT_NOT_NULL(objs[i]);
+        }
+        for (size_t i = 0; i < ARRAY_SIZE(objs); i++) {
+                kmm_cache_free(cache, objs[i]);
+        }
+
+        size_t const before = VMM_MEM_USAGE;
+        size_t const freed = shrinkers_run(0);
+        TEST_ASSERT_TRUE(freed > 0);
+        TEST_ASSERT_EQUAL_size_t(before - freed * PLATFORM_PAGE_SIZE, VMM_MEM_USAGE);
+
+        /* Nothing is left to reclaim. */
+        TEST_ASSERT_EQUAL_size_t(0, shrinkers_run(0));
+
+        kmm_cache_destroy(cache);
+}
+
+static void magazines(void)
+{
+        struct kmm_cache *cache = kmm_cache_create("test_cache", 64, 0, 0, NULL, NULL);
+
+        /* A freed object is the first one to come back. */
+        void *first = kmm_cache_alloc(cache);
+        TEST_ASSERT_NOT_NULL(first);
+        kmm_cache_free(cache, first);
+        TEST_ASSERT_EQUAL_PTR(first, kmm_cache_alloc(cache));
+        kmm_cache_free(cache, first);
+
+        /* Enough objects to overflow both magazines of the CPU into the depot. */
+        void *objs[CONF_KMM_MAGAZINE_SIZE * 4];
+        for (size_t i = 0; i < ARRAY_SIZE(objs); i++) {
+                objs[i] = kmm_cache_alloc(cache);
+                TEST_ASSERT_NOT_NULL(objs[i]);
+        }
+        for (size_t i = 0; i < ARRAY_SIZE(objs); i++) {
+                kmm_cache_free(cache, objs[i]);
+        }
+        TEST_ASSERT_FALSE(slist_is_empty(&cache->depot_full));
+
+        /* Every object is handed out once. */
+        for (size_t i = 0; i < ARRAY_SIZE(objs); i++) {
+                objs[i] = kmm_cache_alloc(cache);
+                for (size_t j = 0; j < i; j++) {
+                        TEST_ASSERT_TRUE(objs[i] != objs[j]);
+                }
+        }
+        for (size_t i = 0; i < ARRAY_SIZE(objs); i++) {
+                kmm_cache_free(cache, objs[i]);
+        }
+
+        /* Trimming gets the memory of cached objects back. */
+        kmm_cache_trim(cache);
+        TEST_ASSERT_TRUE(slist_is_empty(&cache->depot_full));
+        TEST_ASSERT_TRUE(slist_is_empty(&cache->slabs_partial));
+        TEST_ASSERT_TRUE(slist_is_empty(&cache->slabs_empty));
+
+        kmm_cache_destroy(cache);
+}
+
+static void large_free_when_exhausted(void)
+{
+        typedef char big_t[1024];
+
+        struct kmm_cache *c = kmm_cache_create("test_cache", sizeof(big_t), 0,
+                                               KMM_CACHE_NO_MAGAZINE, NULL, NULL);
+        TEST_ASSERT(c);
+
+        big_t *objs[VMM_MEM_LIMIT / sizeof(big_t)];
+        size_t allocated = 0;
+        while ((objs[allocated] = kmm_cache_alloc(c))) {
+                allocated++;
+        }
+        TEST_ASSERT_TRUE(allocated > 0);
+        size_t const usage = VMM_MEM_USAGE;
+
+        /* Freeing a large object must not need any memory. */
+        for (size_t i = 0; i < allocated; i += 2) {
+                kmm_cache_free(c, objs[i]);
+        }
+        TEST_ASSERT_EQUAL_size_t(usage, VMM_MEM_USAGE);
+
+        for (size_t i = 0; i < allocated; i += 2) {
+                objs[i] = kmm_cache_alloc(c);
+                TEST_ASSERT_NOT_NULL(objs[i]);
+        }
+        TEST_ASSERT_NULL(kmm_cache_alloc(c));
+
+        for (size_t i = 0; i < allocated; i++) {
+                for (size_t j = 0; j < i; j++) {
+                        TEST_ASSERT_TRUE(objs[i] != objs[j]);
+                }
+                kmm_cache_free(c, objs[i]);
+        }
+
+        kmm_cache_destroy(c);
+}
+
+static void bulk(void)
+{
+        struct kmm_cache *c = kmm_cache_create("test_cache", 64, 0, 0, NULL, NULL);
+        TEST_ASSERT(c);
+
+        void *objs[100];
+        TEST_ASSERT_TRUE(kmm_cache_alloc_bulk(c, ARRAY_SIZE(objs), objs));
+        for (size_t i = 0; i < ARRAY_SIZE(objs); i++) {
+                TEST_ASSERT_NOT_NULL(objs[i]);
+                memset(objs[i], TESTVAL, 64);
+                for (size_t j = 0; j < i; j++) {
+                        TEST_ASSERT_TRUE(objs[i] != objs[j]);
+                }
+        }
+        TEST_ASSERT_TRUE(slist_is_empty(&c->slabs_empty));
+
+        kmm_cache_free_bulk(c, ARRAY_SIZE(objs), objs);
+        TEST_ASSERT_TRUE(slist_is_empty(&c->slabs_full));
+        TEST_ASSERT_TRUE(slist_is_empty(&c->slabs_partial));
+
+        /* Nothing is allocated if the memory runs out. */
+        void *too_many[VMM_MEM_LIMIT / 64];
+        size_t const usage = VMM_MEM_USAGE;
+        TEST_ASSERT_FALSE(kmm_cache_alloc_bulk(c, ARRAY_SIZE(too_many), too_many));
+        kmm_cache_trim(c);
+        TEST_ASSERT_TRUE(VMM_MEM_USAGE <= usage);
+        TEST_ASSERT_TRUE(slist_is_empty(&c->slabs_full));
+        TEST_ASSERT_TRUE(slist_is_empty(&c->slabs_partial));
+
+        kmm_cache_destroy(c);
+}
+
+static void statistics(void)
+{
+        struct kmm_cache *c = kmm_cache_create("test_cache", 64, 0, 0, NULL, NULL);
+        TEST_ASSERT(c);
+
+        void *objs[80];
+        for (size_t i = 0; i < ARRAY_SIZE(objs); i++) {
+                objs[i] = kmm_cache_alloc(c);
+                TEST_ASSERT_NOT_NULL(objs[i]);
+        }
+        for (size_t i = 0; i < ARRAY_SIZE(objs) / 2; i++) {
+                kmm_cache_free(c, objs[i]);
+        }
+
+        TEST_ASSERT_EQUAL_size_t(ARRAY_SIZE(objs), c->stats.allocs);
+        TEST_ASSERT_EQUAL_size_t(ARRAY_SIZE(objs) / 2, c->stats.frees);
+        TEST_ASSERT_EQUAL_size_t(ARRAY_SIZE(objs) / 2, c->stats.active_objects);
+        TEST_ASSERT_EQUAL_size_t(c->stats.grows, c->stats.active_slabs);
+        TEST_ASSERT_TRUE(c->stats.active_slabs * c->slab_capacity >= ARRAY_SIZE(objs));
+        kmm_dump_stats();
+
+        kmm_cache_free_bulk(c, ARRAY_SIZE(objs) / 2, &objs[ARRAY_SIZE(objs) / 2]);
+        kmm_cache_trim(c);
+        TEST_ASSERT_EQUAL_size_t(0, c->stats.active_objects);
+        TEST_ASSERT_EQUAL_size_t(0, c->stats.active_slabs);
+        TEST_ASSERT_EQUAL_size_t(c->stats.grows, c->stats.shrinks);
+        TEST_ASSERT_EQUAL_size_t(0, kmm_cache_wasted(c));
+
+        kmm_cache_destroy(c);
+}
+
+static void wasted_space(void)
+{
+        /* The objects start after the page header, rounded up to 64. 3 strides of 1024 fit. */
+        struct kmm_cache *c = kmm_cache_create("test_cache", 1000, 64, 0, NULL, NULL);
+        TEST_ASSERT(c);
+        TEST_ASSERT_EQUAL_size_t(3, c->slab_capacity);
+        TEST_ASSERT_EQUAL_size_t(0, kmm_cache_wasted(c));
+
+        void *objs[4];
+        for (size_t i = 0; i < ARRAY_SIZE(objs); i++) {
+                objs[i] = kmm_cache_alloc(c);
+                TEST_ASSERT_NOT_NULL(objs[i]);
+        }
+        TEST_ASSERT_EQUAL_size_t(2, c->stats.active_slabs);
+        TEST_ASSERT_EQUAL_size_t(2 * (PLATFORM_PAGE_SIZE - 64 - 3 * 1024), kmm_cache_wasted(c));
+
+        kmm_cache_free_bulk(c, ARRAY_SIZE(objs), objs);
+        kmm_cache_destroy(c);
+}
+
+static void dense_strides(void)
+{
+        size_t const sizes[] = { 8, 32, 64 };
+        for (size_t i = 0; i < ARRAY_SIZE(sizes); i++) {
+                struct kmm_cache *c = kmm_cache_create("test_cache", sizes[i], 16, 0, NULL, NULL);
+                TEST_ASSERT(c);
+
+                /* Nothing but the alignment is added to an object. */
+                TEST_ASSERT_EQUAL_size_t(align_roundup(sizes[i], 16), c->stride);
+                /* A free object costs a 16-bit index. */
+                size_t const per_object = c->stride + sizeof(uint16_t);
+                TEST_ASSERT_TRUE(c->slab_capacity >= (PLATFORM_PAGE_SIZE - 128) / per_object);
+
+                void *objs[8];
+                for (size_t j = 0; j < ARRAY_SIZE(objs); j++) {
+                        objs[j] = kmm_cache_alloc(c);
+                        TEST_ASSERT_TRUE(check_align((uintptr_t)objs[j], 16));
+                        memset(objs[j], TESTVAL, sizes[i]);
+                }
+                for (size_t j = 0; j < ARRAY_SIZE(objs); j++) {
+                        kmm_cache_free(c, objs[j]);
+                }
+
+                kmm_cache_destroy(c);
+        }
+}
+
+static void merging(void)
+{
+        struct kmm_cache *a = kmm_cache_create("a", 40, 0, KMM_CACHE_MERGEABLE, NULL, NULL);
+        struct kmm_cache *b = kmm_cache_create("b", 40, 0, KMM_CACHE_MERGEABLE, NULL, NULL);
+        struct kmm_cache *other = kmm_cache_create("other", 200, 0, KMM_CACHE_MERGEABLE, NULL,
+                                                   NULL);
+        struct kmm_cache *with_ctor = kmm_cache_create("with_ctor", 40, 0, KMM_CACHE_MERGEABLE,
+                                                       constructor__ctor, NULL);
+        TEST_ASSERT(a && b && other && with_ctor);
+
+        TEST_ASSERT_NOT_NULL(a->merged_into);
+        TEST_ASSERT_EQUAL_PTR(a->merged_into, b->merged_into);
+        TEST_ASSERT_TRUE(other->merged_into != a->merged_into);
+        TEST_ASSERT_NULL(with_ctor->merged_into);
+
+        /* Both caches fill the same slab but keep their own statistics. */
+        size_t const usage = VMM_MEM_USAGE;
+        void *obj_a = kmm_cache_alloc(a);
+        void *obj_b = kmm_cache_alloc(b);
+        TEST_ASSERT_NOT_NULL(obj_a);
+        TEST_ASSERT_NOT_NULL(obj_b);
+        TEST_ASSERT_EQUAL_size_t(usage + PLATFORM_PAGE_SIZE, VMM_MEM_USAGE);
+        TEST_ASSERT_EQUAL_size_t(1, a->stats.active_objects);
+        TEST_ASSERT_EQUAL_size_t(1, b->stats.active_objects);
+        TEST_ASSERT_EQUAL_size_t(2, a->merged_into->stats.active_objects);
+
+        kmm_cache_free(a, obj_a);
+        kmm_cache_free(b, obj_b);
+
+        kmm_cache_destroy(a);
+        kmm_cache_destroy(b);
+        kmm_cache_destroy(other);
+        kmm_cache_destroy(with_ctor);
+        kmm_cache_trim_all();
+        TEST_ASSERT_EQUAL_size_t(0, VMM_MEM_USAGE);
+}
+
+static void reaping(void)
+{
+        struct kmm_cache *c = kmm_cache_create("test_cache", 64, 0, KMM_CACHE_NO_MAGAZINE, NULL,
+                                               NULL);
+        TEST_ASSERT(c);
+
+        kmm_cache_free(c, kmm_cache_alloc(c));
+        TEST_ASSERT_FALSE(slist_is_empty(&c->slabs_empty));
+        size_t const usage = VMM_MEM_USAGE;
+
+        /* A slab that gets used again is younger. */
+        for (size_t i = 0; i < CONF_KMM_REAP_AGE - 1; i++) {
+                kmm_reap_tick();
+                kmm_reap();
+        }
+        kmm_cache_free(c, kmm_cache_alloc(c));
+        kmm_reap_tick();
+        kmm_reap();
+        TEST_ASSERT_FALSE(slist_is_empty(&c->slabs_empty));
+        TEST_ASSERT_EQUAL_size_t(usage, VMM_MEM_USAGE);
+
+        /* An idle slab is released after CONF_KMM_REAP_AGE intervals. Nothing grows meanwhile,
+         * so it's the deferred work that reaps. */
+        for (size_t i = 0; i < CONF_KMM_REAP_AGE - 1; i++) {
+                kmm_reap_tick();
+                deferred_run();
+        }
+        TEST_ASSERT_TRUE(slist_is_empty(&c->slabs_empty));
+        TEST_ASSERT_EQUAL_size_t(usage - PLATFORM_PAGE_SIZE, VMM_MEM_USAGE);
+
+        kmm_cache_destroy(c);
+}
+
+static void reaping_magazines(void)
+{
+        struct kmm_cache *c = kmm_cache_create("test_cache", 64, 0, 0, NULL, NULL);
+        TEST_ASSERT(c);
+
+        size_t const count = 4 * c->slab_capacity;
+        void **objs = malloc(count * sizeof(*objs));
+        TEST_ASSERT_TRUE(kmm_cache_alloc_bulk(c, count, objs));
+        for (size_t i = 0; i < count; i++) {
+                kmm_cache_free(c, objs[i]);
+        }
+
+        /* The objects are cached in magazines, so no slab is empty. */
+        TEST_ASSERT_FALSE(slist_is_empty(&c->depot_full));
+        TEST_ASSERT_TRUE(slist_is_empty(&c->slabs_empty));
+        size_t const usage = VMM_MEM_USAGE;
+
+        /* Old magazines are flushed, and then the slabs they have emptied get old. */
+        for (size_t i = 0; i < CONF_KMM_REAP_AGE; i++) {
+                kmm_reap_tick();
+                deferred_run();
+        }
+        TEST_ASSERT_TRUE(slist_is_empty(&c->depot_full));
+        TEST_ASSERT_FALSE(slist_is_empty(&c->slabs_empty));
+
+        for (size_t i = 0; i < CONF_KMM_REAP_AGE; i++) {
+                kmm_reap_tick();
+                deferred_run();
+        }
+        TEST_ASSERT_TRUE(slist_is_empty(&c->slabs_empty));
+        TEST_ASSERT_TRUE(VMM_MEM_USAGE < usage);
+
+        free(objs);
+        kmm_cache_destroy(c);
+}
+
+static struct kmm_cache static_caches_registered__cache;
+
+static void static_caches_registered(void)
+{
+        struct kmm_cache *c = &static_caches_registered__cache;
+        kmm_cache_init(c, "test_static", 64, 0, KMM_CACHE_NO_MAGAZINE, NULL, NULL);
+        /* Initializing it again doesn't register it twice. */
+        kmm_cache_init(c, "test_static", 64, 0, KMM_CACHE_NO_MAGAZINE, NULL, NULL);
+
+        kmm_cache_free(c, kmm_cache_alloc(c));
+        TEST_ASSERT_EQUAL_size_t(PLATFORM_PAGE_SIZE, VMM_MEM_USAGE);
+
+        kmm_cache_trim_all();
+        TEST_ASSERT_TRUE(slist_is_empty(&c->slabs_empty));
+        TEST_ASSERT_EQUAL_size_t(0, VMM_MEM_USAGE);
+}
+
+static struct kmm_cache *busy_reclaim__other = NULL;
+static bool busy_reclaim__armed = false;
+static size_t busy_reclaim__freed = 0;
+
+/* Runs in the middle of an allocation, as a page fault on a fresh object would. */
+static void busy_reclaim__ctor(void *mem __unused)
+{
+        if (!busy_reclaim__armed) {
+                return;
+        }
+        busy_reclaim__armed = false;
+        busy_reclaim__freed = shrinkers_run(0);
+}
+
+static void reclaim_skips_busy_caches(void)
+{
+        /* The newest cache is the first one the shrinker looks at. */
+        busy_reclaim__other = kmm_cache_create("other_cache", 64, 0, KMM_CACHE_NO_MAGAZINE,
+                                               NULL, NULL);
+        struct kmm_cache *c = kmm_cache_create("busy_cache", 1024, 0,
+                                               KMM_CACHE_NO_MAGAZINE | KMM_CACHE_LAZY_CTOR,
+                                               busy_reclaim__ctor, NULL);
+        TEST_ASSERT(c && busy_reclaim__other);
+
+        /* The first slab becomes empty, the second one keeps a single object. */
+        size_t const capacity = c->slab_capacity;
+        void *objs[16];
+        TEST_ASSERT_TRUE(capacity < ARRAY_SIZE(objs));
+        for (size_t i = 0; i < capacity + 1; i++) {
+                objs[i] = kmm_cache_alloc(c);
+                TEST_ASSERT_NOT_NULL(objs[i]);
+        }
+        for (size_t i = 0; i < capacity; i++) {
+                kmm_cache_free(c, objs[i]);
+        }
+        kmm_cache_free(busy_reclaim__other, kmm_cache_alloc(busy_reclaim__other));
+        TEST_ASSERT_EQUAL_size_t(2, c->stats.active_slabs);
+        TEST_ASSERT_EQUAL_size_t(1, busy_reclaim__other->stats.active_slabs);
+
+        /* The next object is carved from the partial slab, and its constructor reclaims. */
+        busy_reclaim__armed = true;
+        void *obj = kmm_cache_alloc(c);
+        TEST_ASSERT_NOT_NULL(obj);
+        TEST_ASSERT_FALSE(busy_reclaim__armed);
+        TEST_ASSERT_EQUAL_size_t(1, busy_reclaim__freed);
+        TEST_ASSERT_EQUAL_size_t(0, busy_reclaim__other->stats.active_slabs);
+        TEST_ASSERT_EQUAL_size_t(2, c->stats.active_slabs);
+
+        /* Once the allocation is over, the cache can be shrunk as usual. */
+        TEST_ASSERT_EQUAL_size_t(1, shrinkers_run(0));
+        TEST_ASSERT_EQUAL_size_t(1, c->stats.active_slabs);
+
+        kmm_cache_free(c, obj);
+        kmm_cache_free(c, objs[capacity]);
+        kmm_cache_destroy(c);
+        kmm_cache_destroy(busy_reclaim__other);
+}
+
 int main(void)
 {
         UNITY_BEGIN();
@@ -356,8 +812,21 @@ int main(void)
         RUN_TEST(memory_aligned);
         RUN_TEST(constructor);
         RUN_TEST(destructor);
+        RUN_TEST(lazy_constructor);
         RUN_TEST(trimming);
         RUN_TEST(cache_coloring);
+        RUN_TEST(shrinking);
+        RUN_TEST(magazines);
+        RUN_TEST(large_free_when_exhausted);
+        RUN_TEST(bulk);
+        RUN_TEST(statistics);
+        RUN_TEST(wasted_space);
+        RUN_TEST(dense_strides);
+        RUN_TEST(merging);
+        RUN_TEST(reaping);
+        RUN_TEST(reaping_magazines);
+        RUN_TEST(static_caches_registered);
+        RUN_TEST(reclaim_skips_busy_caches);
         UNITY_END();
         return (0);
 }
@@ -0,0 +1,152 @@
+#include "kernel/mm/kstack.h"
+
+#include "kernel/config.h"
+#include "kernel/kernel.h"
+#include "kernel/mm/mm.h"
+#include "kernel/mm/vm.h"
+#include "kernel/mm/vm_area.h"
+#include "kernel/platform_consts.h"
+
+#include "lib/cppdefs.h"
+#include "lib/cstd/assert.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define GUARD_SIZE (PLATFORM_PAGE_SIZE)
+#define AREA_SIZE  (GUARD_SIZE + CONF_STACK_SIZE)
+
+/* Recently freed stacks that are still mapped. */
+struct stack_cache {
+        struct vm_area *areas[CONF_KSTACK_CACHE_SIZE];
+        size_t count;
+};
+
+static struct stack_cache CACHES[CONF_MAX_CPUS];
+static struct vm_space *VMSPACE = NULL;
+
+static void *stack_bottom(struct vm_area *area)
+{
+        return ((void *)((uintptr_t)area->base + GUARD_SIZE));
+}
+
+static void *stack_top(struct vm_area *area)
+{
+        return ((void *)((uintptr_t)area->base + AREA_SIZE));
+}
+
+static void stack_pgfault_handler(struct vm_area *area, void *addr, enum vm_fault_flags fault)
+{
+        /* Stacks are populated in advance, so any fault is a bug.
+         * A fault with the stack pointer in the guard page can't be delivered on that stack,
+         * so overflows themselves are reported by the double fault handler. */
+        vm_pgfault_handle_panic(area, addr, fault);
+}
+
+static struct vm_area_ops const STACK_OPS = {
+        .handle_pg_fault = stack_pgfault_handler,
+};
+
+static bool is_stack_area(struct vm_area const *area)
+{
+        return (area != NULL && area->ops.handle_pg_fault == stack_pgfault_handler);
+}
+
+static void unmap_stack(struct vm_area *area, size_t pages)
+{
+        void *const bottom = stack_bottom(area);
+
+        for (size_t i = 0; i < pages; i++) {
+                void *page = (void *)((uintptr_t)bottom + i * PLATFORM_PAGE_SIZE);
+                mm_free_page(vm_arch_resolve_phys_page(VMSPACE->root_dir, page));
+        }
+
+        vm_arch_pt_unmap_range(VMSPACE->root_dir, bottom, pages);
+}
+
+static struct vm_area *new_stack(void)
+{
+        struct vm_area *area = vm_new_area_within_space(VMSPACE, AREA_SIZE, AREA_SIZE);
+        if (__unlikely(area == NULL)) {
+                return (NULL);
+        }
+        kassert(area->length == AREA_SIZE);
+
+        area->flags = VM_WRITE;
+        area->ops = STACK_OPS;
+
+        /* The guard page stays unmapped. */
+        void *const bottom = stack_bottom(area);
+        size_t const pages = CONF_STACK_SIZE / PLATFORM_PAGE_SIZE;
+        for (size_t i = 0; i < pages; i++) {
+                struct mm_page *frame = mm_alloc_page();
+                if (__unlikely(frame == NULL)) {
+                        unmap_stack(area, i);
+                        vm_free_area(area);
+                        return (NULL);
+                }
+
+                void *page = (void *)((uintptr_t)bottom + i * PLATFORM_PAGE_SIZE);
+                vm_arch_pt_map(VMSPACE->root_dir, frame->paddr, page, area->flags);
+        }
+
+        return (area);
+}
+
+void kstack_init(struct vm_space *space)
+{
+        kassert(space != NULL);
+        /* Kernel stacks must consist of whole pages. */
+        kassert(CONF_STACK_SIZE % PLATFORM_PAGE_SIZE == 0);
+
+        VMSPACE = space;
+}
+
+void *kstack_alloc(void)
+{
+        kassert(VMSPACE != NULL);
+
+        struct stack_cache *cache = &CACHES[kernel_arch_get_cpu_id()];
+        if (cache->count > 0) {
+                return (stack_top(cache->areas[--cache->count]));
+        }
+
+        struct vm_area *area = new_stack();
+        if (__unlikely(area == NULL)) {
+                return (NULL);
+        }
+
+        return (stack_top(area));
+}
+
+void kstack_free(void *top)
+{
+        kassert(VMSPACE != NULL);
+
+        void *const last_byte = (void *)((uintptr_t)top - 1);
+        struct vm_area *area = vm_space_find_area(VMSPACE, last_byte);
+        kassert(is_stack_area(area));
+        kassert(stack_top(area) == top);
+
+        struct stack_cache *cache = &CACHES[kernel_arch_get_cpu_id()];
+        if (cache->count < CONF_KSTACK_CACHE_SIZE) {
+                cache->areas[cache->count++] = area;
+                return;
+        }
+
+        unmap_stack(area, CONF_STACK_SIZE / PLATFORM_PAGE_SIZE);
+        vm_free_area(area);
+}
+
+bool kstack_is_guard(void const *addr)
+{
+        /* Overflows may happen before the stacks are set up. */
+        if (VMSPACE == NULL) {
+                return (false);
+        }
+
+        /* The lookup doesn't take the space lock, so the faulted code may hold it. */
+        struct vm_area *area = vm_space_find_area(VMSPACE, addr);
+        return (is_stack_area(area) && (uintptr_t)addr < (uintptr_t)stack_bottom(area));
+}
@@ -0,0 +1,211 @@
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/kstack.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/vm.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/vm_space.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/vm_area.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/kmm.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/deferred.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/shrinker.c
+// UNITY_TEST DEPENDS ON: kernel/lib/cstd/string/memset.c
+// UNITY_TEST DEPENDS ON: kernel/lib/ds/rbtree.c
+// UNITY_TEST DEPENDS ON: kernel/lib/ds/slist.c
+// UNITY_TEST DEPENDS ON: kernel/test_fakes/panic.c
+
+#include "kernel/mm/kstack.h"
+
+#include "kernel/config.h"
+#include "kernel/mm/kmm.h"
+#include "kernel/mm/mm.h"
+#include "kernel/mm/vm.h"
+#include "kernel/mm/vm_space.h"
+
+#include "lib/utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unity.h>
+
+size_t const PLATFORM_PAGE_SIZE = 4096;
+
+#define STACK_PAGES (CONF_STACK_SIZE / PLATFORM_PAGE_SIZE)
+#define MAX_MAPPINGS (64)
+
+/* Frames are numbered from one, so that a frame is never NULL. */
+static size_t FRAMES_LIMIT = 0;
+static size_t FRAMES_USED = 0;
+static struct mm_page FRAME;
+
+struct mm_page *mm_alloc_page(void)
+{
+        if (FRAMES_USED == FRAMES_LIMIT) {
+                return (NULL);
+        }
+        FRAMES_USED++;
+        FRAME.paddr = (phys_addr_t)(uintptr_t)FRAMES_USED;
+        return (&FRAME);
+}
+
+void mm_free_page(phys_addr_t addr)
+{
+        TEST_ASSERT_NOT_NULL(addr);
+        FRAMES_USED--;
+}
+
+static struct mapping {
+        void const *vaddr;
+        uintptr_t paddr;
+} MAPPINGS[MAX_MAPPINGS];
+
+static struct mapping *find_mapping(void const *vaddr)
+{
+        for (size_t i = 0; i < ARRAY_SIZE(MAPPINGS); i++) {
+                if (MAPPINGS[i].vaddr == vaddr) {
+                        return (&MAPPINGS[i]);
+                }
+        }
+        return (NULL);
+}
+
+void vm_arch_pt_map(void *tree_root __unused, const void *phys_addr, const void *at_virt_addr,
+                    enum vm_flags flags __unused)
+{
+        TEST_ASSERT_NULL(find_mapping(at_virt_addr));
+        struct mapping *m = find_mapping(NULL);
+        TEST_ASSERT_NOT_NULL(m);
+        m->vaddr = at_virt_addr;
+        m->paddr = (uintptr_t)phys_addr;
+}
+
+void vm_arch_pt_unmap_range(void *tree_root __unused, void *virt_addr, size_t pages)
+{
+        for (size_t i = 0; i < pages; i++) {
+                struct mapping *m = find_mapping((uint8_t *)virt_addr + i * PLATFORM_PAGE_SIZE);
+                TEST_ASSERT_NOT_NULL(m);
+                m->vaddr = NULL;
+        }
+}
+
+void *vm_arch_resolve_phys_page(void *tree_root __unused, void const *virt_page)
+{
+        struct mapping *m = find_mapping(virt_page);
+        return (m != NULL ? (void *)m->paddr : NULL);
+}
+
+void vm_arch_pt_pool_refill(void) {}
+
+bool vm_arch_is_range_valid(void const *base __unused, size_t len __unused)
+{
+        return (true);
+}
+
+static void *alloc_page(void)
+{
+        return (aligned_alloc(PLATFORM_PAGE_SIZE, PLATFORM_PAGE_SIZE));
+}
+
+static void free_page(void *mem)
+{
+        free(mem);
+}
+
+static struct vm_space SPACE;
+static uint32_t ROOT_DIR;
+
+void setUp(void)
+{
+        FRAMES_LIMIT = 64;
+}
+
+void tearDown(void) {}
+
+static void guard_page_unmapped(void)
+{
+        uint8_t *top = kstack_alloc();
+        TEST_ASSERT_NOT_NULL(top);
+        TEST_ASSERT_EQUAL_size_t(0, (uintptr_t)top % PLATFORM_PAGE_SIZE);
+
+        uint8_t *const bottom = top - CONF_STACK_SIZE;
+        for (size_t i = 0; i < STACK_PAGES; i++) {
+                TEST_ASSERT_NOT_NULL(find_mapping(bottom + i * PLATFORM_PAGE_SIZE));
+        }
+
+        uint8_t *const guard = bottom - PLATFORM_PAGE_SIZE;
+        TEST_ASSERT_NULL(find_mapping(guard));
+        TEST_ASSERT_TRUE(kstack_is_guard(guard));
+        TEST_ASSERT_TRUE(kstack_is_guard(bottom - 1));
+        TEST_ASSERT_FALSE(kstack_is_guard(bottom));
+        TEST_ASSERT_FALSE(kstack_is_guard(top - 1));
+        TEST_ASSERT_FALSE(kstack_is_guard(top + PLATFORM_PAGE_SIZE));
+
+        kstack_free(top);
+}
+
+static void freed_stacks_reused(void)
+{
+        void *top = kstack_alloc();
+        TEST_ASSERT_NOT_NULL(top);
+        size_t const used = FRAMES_USED;
+
+        kstack_free(top);
+        TEST_ASSERT_EQUAL_size_t(used, FRAMES_USED);
+
+        TEST_ASSERT_EQUAL_PTR(top, kstack_alloc());
+        TEST_ASSERT_EQUAL_size_t(used, FRAMES_USED);
+        kstack_free(top);
+}
+
+static void overflowing_cache_unmaps(void)
+{
+        void *tops[CONF_KSTACK_CACHE_SIZE + 1];
+        for (size_t i = 0; i < ARRAY_SIZE(tops); i++) {
+                tops[i] = kstack_alloc();
+                TEST_ASSERT_NOT_NULL(tops[i]);
+        }
+        size_t const used = FRAMES_USED;
+
+        for (size_t i = 0; i < ARRAY_SIZE(tops); i++) {
+                kstack_free(tops[i]);
+        }
+
+        /* The cache keeps the first stacks, the last one is returned. */
+        TEST_ASSERT_EQUAL_size_t(used - STACK_PAGES, FRAMES_USED);
+        void *const last_top = tops[ARRAY_SIZE(tops) - 1];
+        TEST_ASSERT_NULL(find_mapping((uint8_t *)last_top - PLATFORM_PAGE_SIZE));
+        TEST_ASSERT_NULL(vm_space_find_area(&SPACE, (uint8_t *)last_top - 1));
+}
+
+static void no_frames(void)
+{
+        /* Drain the cache of the previous tests. */
+        void *cached[CONF_KSTACK_CACHE_SIZE];
+        for (size_t i = 0; i < ARRAY_SIZE(cached); i++) {
+                cached[i] = kstack_alloc();
+                TEST_ASSERT_NOT_NULL(cached[i]);
+        }
+
+        size_t const used = FRAMES_USED;
+        FRAMES_LIMIT = used + STACK_PAGES - 1;
+        TEST_ASSERT_NULL(kstack_alloc());
+        TEST_ASSERT_EQUAL_size_t(used, FRAMES_USED);
+
+        for (size_t i = 0; i < ARRAY_SIZE(cached); i++) {
+                kstack_free(cached[i]);
+        }
+}
+
+int main(void)
+{
+        kmm_init(alloc_page, free_page);
+        vm_init();
+        vm_space_init(&SPACE, (phys_addr_t)&ROOT_DIR, PLATFORM_PAGE_SIZE);
+        kstack_init(&SPACE);
+
+        UNITY_BEGIN();
+        RUN_TEST(guard_page_unmapped);
+        RUN_TEST(freed_stacks_reused);
+        RUN_TEST(overflowing_cache_unmaps);
+        RUN_TEST(no_frames);
+        UNITY_END();
+        return (0);
+}
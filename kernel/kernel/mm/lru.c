@@ -0,0 +1,165 @@
+#include "kernel/mm/lru.h"
+
+#include "kernel/mm/mm.h"
+#include "kernel/mm/shrinker.h"
+#include "kernel/mm/swap.h"
+#include "kernel/mm/vm.h"
+
+#include "lib/cppdefs.h"
+#include "lib/cstd/assert.h"
+#include "lib/ds/dclist.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* The first page of a list is the most recently added one. */
+DCLIST_HEAD(lru_head, struct mm_page);
+
+static struct {
+        struct lru_head active;
+        struct lru_head inactive;
+        size_t active_count;
+        size_t inactive_count;
+} LRU;
+
+static void list_add(struct mm_page *page, enum page_lru list)
+{
+        kassert(list != PAGELRU_NONE);
+
+        page->lru_state = list;
+        if (list == PAGELRU_ACTIVE) {
+                DCLIST_INSERT_FIRST(&LRU.active, page, lru);
+                LRU.active_count++;
+        } else {
+                DCLIST_INSERT_FIRST(&LRU.inactive, page, lru);
+                LRU.inactive_count++;
+        }
+}
+
+static void list_del(struct mm_page *page)
+{
+        if (page->lru_state == PAGELRU_ACTIVE) {
+                DCLIST_REMOVE(&LRU.active, page, lru);
+                LRU.active_count--;
+        } else {
+                kassert(page->lru_state == PAGELRU_INACTIVE);
+                DCLIST_REMOVE(&LRU.inactive, page, lru);
+                LRU.inactive_count--;
+        }
+        page->lru_state = PAGELRU_NONE;
+}
+
+static void move_to(struct mm_page *page, enum page_lru list)
+{
+        list_del(page);
+        list_add(page, list);
+}
+
+static bool test_and_clear_accessed(struct mm_page *page)
+{
+        return (vm_arch_pt_test_and_clear_accessed(page->lru_area->owner->root_dir,
+                                                   page->lru_addr));
+}
+
+void lru_add(struct mm_page *page, struct vm_area *area, void *vaddr)
+{
+        kassert(page != NULL && area != NULL);
+        kassert(page->lru_state == PAGELRU_NONE);
+        kassert(vm_arch_resolve_phys_page(area->owner->root_dir, vaddr) == page->paddr);
+
+        page->lru_area = area;
+        page->lru_addr = vaddr;
+        list_add(page, PAGELRU_ACTIVE);
+}
+
+void lru_remove(struct mm_page *page)
+{
+        kassert(page != NULL);
+        list_del(page);
+        page->lru_area = NULL;
+        page->lru_addr = NULL;
+}
+
+/* Keep the inactive list as long as the active one. Pages used since the last look stay. */
+static void age_active(void)
+{
+        size_t budget = LRU.active_count;
+        while (LRU.inactive_count < LRU.active_count && budget-- > 0) {
+                struct mm_page *page = DCLIST_LAST(&LRU.active, lru);
+                if (test_and_clear_accessed(page)) {
+                        move_to(page, PAGELRU_ACTIVE);
+                } else {
+                        move_to(page, PAGELRU_INACTIVE);
+                }
+        }
+}
+
+static bool evict(struct mm_page *page)
+{
+        void *const root = page->lru_area->owner->root_dir;
+        void *const vaddr = page->lru_addr;
+
+        if (!swap_out(vaddr, vaddr)) {
+                return (false);
+        }
+
+        lru_remove(page);
+        vm_arch_pt_unmap(root, vaddr);
+        mm_free_page(page->paddr);
+        return (true);
+}
+
+size_t lru_reclaim(size_t nr)
+{
+        size_t freed = 0;
+        size_t budget = LRU.active_count + LRU.inactive_count;
+
+        while (freed < nr && budget-- > 0) {
+                age_active();
+
+                struct mm_page *page = DCLIST_LAST(&LRU.inactive, lru);
+                if (page == NULL) {
+                        break;
+                }
+
+                if (test_and_clear_accessed(page)) {
+                        /* Used twice in a row. */
+                        move_to(page, PAGELRU_ACTIVE);
+                } else if (evict(page)) {
+                        freed++;
+                } else {
+                        /* There is no space to swap it out. Try the others. */
+                        move_to(page, PAGELRU_INACTIVE);
+                }
+        }
+
+        return (freed);
+}
+
+static size_t shrinker_count(struct shrinker *s __unused)
+{
+        return (LRU.active_count + LRU.inactive_count);
+}
+
+static size_t shrinker_scan(struct shrinker *s __unused, size_t nr)
+{
+        return (lru_reclaim(nr));
+}
+
+/* Swapping out costs more than dropping free objects of the caches. */
+static struct shrinker LRU_SHRINKER = {
+        .name = "lru",
+        .count = shrinker_count,
+        .scan = shrinker_scan,
+        .seeks = 4,
+};
+
+void lru_init(void)
+{
+        DCLIST_INIT(&LRU.active);
+        DCLIST_INIT(&LRU.inactive);
+        LRU.active_count = 0;
+        LRU.inactive_count = 0;
+
+        shrinker_register(&LRU_SHRINKER);
+}
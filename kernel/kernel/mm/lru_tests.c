@@ -0,0 +1,171 @@
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/lru.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/shrinker.c
+// UNITY_TEST DEPENDS ON: kernel/lib/ds/slist.c
+// UNITY_TEST DEPENDS ON: kernel/test_fakes/panic.c
+
+#include "kernel/mm/lru.h"
+
+#include "kernel/mm/mm.h"
+#include "kernel/mm/shrinker.h"
+#include "kernel/mm/swap.h"
+#include "kernel/mm/vm_area.h"
+#include "kernel/mm/vm_space.h"
+
+#include "lib/utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <unity.h>
+
+size_t const PLATFORM_PAGE_SIZE = 4096;
+
+#define PAGES_COUNT (8)
+
+static struct vm_space SPACE;
+static struct vm_area AREA = { .owner = &SPACE };
+static struct mm_page PAGES[PAGES_COUNT];
+
+/* The state of the fake page tables, indexed like PAGES. */
+static bool MAPPED[PAGES_COUNT];
+static bool ACCESSED[PAGES_COUNT];
+static bool SWAPPED[PAGES_COUNT];
+static bool SWAP_FULL = false;
+static size_t FREED = 0;
+
+static void *vaddr_of(size_t ndx)
+{
+        return ((void *)((ndx + 1) * PLATFORM_PAGE_SIZE));
+}
+
+static size_t ndx_of(void const *vaddr)
+{
+        size_t const ndx = (uintptr_t)vaddr / PLATFORM_PAGE_SIZE - 1;
+        TEST_ASSERT_TRUE(ndx < PAGES_COUNT);
+        return (ndx);
+}
+
+void *vm_arch_resolve_phys_page(void *tree_root, void const *virt_page)
+{
+        TEST_ASSERT_EQUAL_PTR(SPACE.root_dir, tree_root);
+        size_t const ndx = ndx_of(virt_page);
+        return (MAPPED[ndx] ? PAGES[ndx].paddr : NULL);
+}
+
+bool vm_arch_pt_test_and_clear_accessed(void *tree_root __unused, void *virt_page)
+{
+        size_t const ndx = ndx_of(virt_page);
+        TEST_ASSERT_TRUE(MAPPED[ndx]);
+        bool const accessed = ACCESSED[ndx];
+        ACCESSED[ndx] = false;
+        return (accessed);
+}
+
+void vm_arch_pt_unmap(void *tree_root __unused, void *virt_addr)
+{
+        size_t const ndx = ndx_of(virt_addr);
+        TEST_ASSERT_TRUE(MAPPED[ndx]);
+        MAPPED[ndx] = false;
+}
+
+void mm_free_page(phys_addr_t addr)
+{
+        size_t const ndx = (uintptr_t)addr - 1;
+        TEST_ASSERT_FALSE(MAPPED[ndx]);
+        TEST_ASSERT_EQUAL_INT(PAGELRU_NONE, PAGES[ndx].lru_state);
+        FREED++;
+}
+
+bool swap_out(void const *key, void const *page)
+{
+        TEST_ASSERT_EQUAL_PTR(key, page);
+        if (SWAP_FULL) {
+                return (false);
+        }
+        SWAPPED[ndx_of(key)] = true;
+        return (true);
+}
+
+void setUp(void)
+{
+        lru_init();
+        SPACE.root_dir = (phys_addr_t)&SPACE;
+        SWAP_FULL = false;
+        FREED = 0;
+
+        for (size_t i = 0; i < PAGES_COUNT; i++) {
+                PAGES[i] = (struct mm_page){ .paddr = (phys_addr_t)(i + 1),
+                                             .state = PAGESTATE_OCCUPIED };
+                MAPPED[i] = true;
+                ACCESSED[i] = false;
+                SWAPPED[i] = false;
+                lru_add(&PAGES[i], &AREA, vaddr_of(i));
+        }
+}
+
+void tearDown(void)
+{
+        for (size_t i = 0; i < PAGES_COUNT; i++) {
+                if (PAGES[i].lru_state != PAGELRU_NONE) {
+                        lru_remove(&PAGES[i]);
+                }
+        }
+}
+
+static void oldest_unused_evicted_first(void)
+{
+        TEST_ASSERT_EQUAL_size_t(2, lru_reclaim(2));
+        TEST_ASSERT_EQUAL_size_t(2, FREED);
+
+        /* Pages are added to the front, so the first ones are the oldest. */
+        TEST_ASSERT_TRUE(SWAPPED[0]);
+        TEST_ASSERT_TRUE(SWAPPED[1]);
+        for (size_t i = 2; i < PAGES_COUNT; i++) {
+                TEST_ASSERT_FALSE(SWAPPED[i]);
+                TEST_ASSERT_TRUE(MAPPED[i]);
+        }
+}
+
+static void accessed_pages_stay(void)
+{
+        for (size_t i = 0; i < PAGES_COUNT; i++) {
+                ACCESSED[i] = i % 2 == 0;
+        }
+
+        /* The first look clears the accessed bits, so don't ask for more than the unused pages. */
+        TEST_ASSERT_EQUAL_size_t(PAGES_COUNT / 2, lru_reclaim(PAGES_COUNT / 2));
+        for (size_t i = 0; i < PAGES_COUNT; i++) {
+                TEST_ASSERT_EQUAL_INT(i % 2 != 0, SWAPPED[i]);
+        }
+}
+
+static void full_swap_keeps_pages(void)
+{
+        SWAP_FULL = true;
+
+        TEST_ASSERT_EQUAL_size_t(0, lru_reclaim(PAGES_COUNT));
+        TEST_ASSERT_EQUAL_size_t(0, FREED);
+        for (size_t i = 0; i < PAGES_COUNT; i++) {
+                TEST_ASSERT_TRUE(MAPPED[i]);
+                TEST_ASSERT_TRUE(PAGES[i].lru_state != PAGELRU_NONE);
+        }
+}
+
+static void shrinker_reclaims(void)
+{
+        /* The LRU is the only shrinker here. */
+        TEST_ASSERT_EQUAL_size_t(1, shrinkers_run(SHRINKER_PRIORITY_DEFAULT));
+        TEST_ASSERT_EQUAL_size_t(PAGES_COUNT - 1, shrinkers_run(0));
+        TEST_ASSERT_EQUAL_size_t(0, shrinkers_run(0));
+}
+
+int main(void)
+{
+        UNITY_BEGIN();
+        RUN_TEST(oldest_unused_evicted_first);
+        RUN_TEST(accessed_pages_stay);
+        RUN_TEST(full_swap_keeps_pages);
+        RUN_TEST(shrinker_reclaims);
+        UNITY_END();
+        return (0);
+}
@@ -0,0 +1,96 @@
+#include "kernel/mm/mempool.h"
+
+#include "kernel/mm/kmm.h"
+
+#include "lib/cppdefs.h"
+#include "lib/cstd/assert.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void mempool_init(struct mempool *pool, void **reserve, size_t min_nr, mempool_alloc_fn_t alloc,
+                  mempool_free_fn_t free, void *pool_data)
+{
+        kassert(pool != NULL);
+        kassert(reserve != NULL || min_nr == 0);
+        kassert(alloc != NULL && free != NULL);
+
+        pool->alloc = alloc;
+        pool->free = free;
+        pool->pool_data = pool_data;
+        pool->reserve = reserve;
+        pool->min_nr = min_nr;
+        pool->curr_nr = 0;
+}
+
+bool mempool_refill(struct mempool *pool)
+{
+        kassert(pool != NULL);
+
+        while (pool->curr_nr < pool->min_nr) {
+                void *elem = pool->alloc(pool->pool_data);
+                if (__unlikely(elem == NULL)) {
+                        return (false);
+                }
+                pool->reserve[pool->curr_nr++] = elem;
+        }
+
+        return (true);
+}
+
+void mempool_drain(struct mempool *pool)
+{
+        kassert(pool != NULL);
+
+        while (pool->curr_nr > 0) {
+                pool->free(pool->reserve[--pool->curr_nr], pool->pool_data);
+        }
+}
+
+void *mempool_alloc(struct mempool *pool)
+{
+        kassert(pool != NULL);
+
+        /* The reserve is the last resort. Keep it for the moments the allocator fails. */
+        void *elem = pool->alloc(pool->pool_data);
+        if (__likely(elem != NULL)) {
+                return (elem);
+        }
+
+        if (__unlikely(pool->curr_nr == 0)) {
+                return (NULL);
+        }
+        return (pool->reserve[--pool->curr_nr]);
+}
+
+void *mempool_alloc_reserved(struct mempool *pool)
+{
+        kassert(pool != NULL);
+
+        if (pool->curr_nr == 0) {
+                return (NULL);
+        }
+        return (pool->reserve[--pool->curr_nr]);
+}
+
+void mempool_free(struct mempool *pool, void *elem)
+{
+        kassert(pool != NULL);
+        kassert(elem != NULL);
+
+        if (pool->curr_nr < pool->min_nr) {
+                pool->reserve[pool->curr_nr++] = elem;
+                return;
+        }
+        pool->free(elem, pool->pool_data);
+}
+
+void *mempool_alloc_slab(void *cache)
+{
+        return (kmm_cache_alloc(cache));
+}
+
+void mempool_free_slab(void *elem, void *cache)
+{
+        kmm_cache_free(cache, elem);
+}
@@ -0,0 +1,133 @@
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/mempool.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/kmm.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/deferred.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/shrinker.c
+// UNITY_TEST DEPENDS ON: kernel/lib/cstd/string/memset.c
+// UNITY_TEST DEPENDS ON: kernel/lib/ds/slist.c
+// UNITY_TEST DEPENDS ON: kernel/test_fakes/panic.c
+
+#include "kernel/mm/mempool.h"
+
+#include "lib/utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <unity.h>
+
+size_t const PLATFORM_PAGE_SIZE = 4096;
+
+#define OBJ_SIZE (64)
+
+static size_t BACKING_LIMIT = 0;
+static size_t BACKING_USAGE = 0;
+
+static void *backing_alloc(void *pool_data)
+{
+        TEST_ASSERT_EQUAL_PTR(&BACKING_LIMIT, pool_data);
+        if (BACKING_USAGE == BACKING_LIMIT) {
+                return (NULL);
+        }
+        BACKING_USAGE++;
+        return (malloc(OBJ_SIZE));
+}
+
+static void backing_free(void *elem, void *pool_data)
+{
+        TEST_ASSERT_EQUAL_PTR(&BACKING_LIMIT, pool_data);
+        BACKING_USAGE--;
+        free(elem);
+}
+
+static struct mempool POOL;
+static void *RESERVE[4];
+
+void setUp(void)
+{
+        BACKING_LIMIT = 16;
+        BACKING_USAGE = 0;
+        mempool_init(&POOL, RESERVE, ARRAY_SIZE(RESERVE), backing_alloc, backing_free,
+                     &BACKING_LIMIT);
+}
+
+void tearDown(void)
+{
+        mempool_drain(&POOL);
+        TEST_ASSERT_EQUAL_size_t(0, BACKING_USAGE);
+}
+
+static void refill_fills_reserve(void)
+{
+        TEST_ASSERT_TRUE(mempool_refill(&POOL));
+        TEST_ASSERT_EQUAL_size_t(ARRAY_SIZE(RESERVE), POOL.curr_nr);
+        TEST_ASSERT_EQUAL_size_t(ARRAY_SIZE(RESERVE), BACKING_USAGE);
+
+        /* A full reserve stays as is. */
+        TEST_ASSERT_TRUE(mempool_refill(&POOL));
+        TEST_ASSERT_EQUAL_size_t(ARRAY_SIZE(RESERVE), BACKING_USAGE);
+}
+
+static void reserve_used_on_failure(void)
+{
+        TEST_ASSERT_TRUE(mempool_refill(&POOL));
+
+        /* The backing allocator has already given a part of its objects to the reserve. */
+        void *objs[16];
+        size_t allocated = 0;
+        for (size_t i = 0; i < ARRAY_SIZE(objs); i++) {
+                objs[i] = mempool_alloc(&POOL);
+                TEST_ASSERT_NOT_NULL(objs[i]);
+                allocated++;
+        }
+        TEST_ASSERT_EQUAL_size_t(0, POOL.curr_nr);
+        TEST_ASSERT_NULL(mempool_alloc(&POOL));
+
+        /* Frees go to the reserve first. */
+        for (size_t i = 0; i < allocated; i++) {
+                mempool_free(&POOL, objs[i]);
+        }
+        TEST_ASSERT_EQUAL_size_t(ARRAY_SIZE(RESERVE), POOL.curr_nr);
+        TEST_ASSERT_EQUAL_size_t(ARRAY_SIZE(RESERVE), BACKING_USAGE);
+}
+
+static void partial_refill(void)
+{
+        BACKING_LIMIT = 2;
+        TEST_ASSERT_FALSE(mempool_refill(&POOL));
+        TEST_ASSERT_EQUAL_size_t(2, POOL.curr_nr);
+
+        BACKING_LIMIT = 16;
+        TEST_ASSERT_TRUE(mempool_refill(&POOL));
+        TEST_ASSERT_EQUAL_size_t(ARRAY_SIZE(RESERVE), POOL.curr_nr);
+}
+
+static void reserved_alloc_never_allocates(void)
+{
+        TEST_ASSERT_NULL(mempool_alloc_reserved(&POOL));
+        TEST_ASSERT_EQUAL_size_t(0, BACKING_USAGE);
+
+        TEST_ASSERT_TRUE(mempool_refill(&POOL));
+        void *objs[ARRAY_SIZE(RESERVE)];
+        for (size_t i = 0; i < ARRAY_SIZE(objs); i++) {
+                objs[i] = mempool_alloc_reserved(&POOL);
+                TEST_ASSERT_NOT_NULL(objs[i]);
+        }
+        TEST_ASSERT_NULL(mempool_alloc_reserved(&POOL));
+        TEST_ASSERT_EQUAL_size_t(ARRAY_SIZE(RESERVE), BACKING_USAGE);
+
+        for (size_t i = 0; i < ARRAY_SIZE(objs); i++) {
+                mempool_free(&POOL, objs[i]);
+        }
+        TEST_ASSERT_EQUAL_size_t(ARRAY_SIZE(RESERVE), POOL.curr_nr);
+}
+
+int main(void)
+{
+        UNITY_BEGIN();
+        RUN_TEST(refill_fills_reserve);
+        RUN_TEST(reserve_used_on_failure);
+        RUN_TEST(partial_refill);
+        RUN_TEST(reserved_alloc_never_allocates);
+        UNITY_END();
+        return (0);
+}
@@ -1,7 +1,10 @@
 #include "kernel/mm/mm.h"
 
 #include "kernel/kernel.h"
+#include "kernel/config.h"
+#include "kernel/deferred.h"
 #include "kernel/klog.h"
+#include "kernel/mm/shrinker.h"
 #include "kernel/platform_consts.h"
 
 #include "lib/align.h"
@@ -10,10 +13,29 @@
 #include "lib/mm/linear.h"
 
 static struct slist_ref MM_ZONES;
+static size_t FREE_PAGES = 0;
+
+/* Reclaim while the memory isn't short yet. It's never done right in mm_alloc_page():
+ * the allocation may come from a page fault in the middle of an update of some structure
+ * the shrinkers walk. */
+static void reclaim_background(void)
+{
+        while (FREE_PAGES < CONF_MM_LOW_WATERMARK_PAGES) {
+                if (shrinkers_run(SHRINKER_PRIORITY_DEFAULT) == 0) {
+                        break;
+                }
+        }
+}
+
+static struct deferred_work RECLAIM_WORK = {
+        .name = "mm_reclaim",
+        .fn = reclaim_background,
+};
 
 void mm_init(void)
 {
         slist_init(&MM_ZONES);
+        deferred_register(&RECLAIM_WORK);
 }
 
 static void mm_zone_register(struct mm_zone *zone)
@@ -50,7 +72,9 @@ struct mm_zone *mm_zone_create(void *phys_start, size_t length, struct vm_space
         kassert(check_align(area_start, PLATFORM_PAGE_SIZE));
 
         vm_area_init(&tmp_area, (void *)area_start, length, kernel_vmspace);
+        vm_space_lock(kernel_vmspace);
         vm_space_insert_area(kernel_vmspace, &tmp_area);
+        vm_space_unlock(kernel_vmspace);
 
         tmp_area.length = length;
         tmp_area.flags |= VM_WRITE;
@@ -64,8 +88,10 @@ struct mm_zone *mm_zone_create(void *phys_start, size_t length, struct vm_space
 
         kmemcpy(&zone->info_area, &tmp_area, sizeof(zone->info_area));
         zone->info_area.rb_areas.data = &zone->info_area;
+        vm_space_lock(kernel_vmspace);
         vm_space_remove_area(kernel_vmspace, &tmp_area);
         vm_space_insert_area(kernel_vmspace, &zone->info_area);
+        vm_space_unlock(kernel_vmspace);
 
         zone->start = phys_start;
         zone->length = length;
@@ -98,6 +124,7 @@ struct mm_zone *mm_zone_create(void *phys_start, size_t length, struct vm_space
         }
 
         zone->pages_count = free_pages - used_pages;
+        FREE_PAGES += zone->pages_count;
         mm_zone_register(zone);
 
         return (zone);
@@ -109,6 +136,11 @@ void mm_page_init_free(struct mm_page *p, void *phys_addr)
 
         p->paddr = phys_addr;
         p->state = PAGESTATE_FREE;
+        p->pt_used = 0;
+        p->lru_state = PAGELRU_NONE;
+        DCLIST_FIELD_INIT(p, lru);
+        p->lru_area = NULL;
+        p->lru_addr = NULL;
 }
 
 struct mm_page *mm_alloc_page_from(struct mm_zone *zone)
@@ -123,15 +155,33 @@ struct mm_page *mm_alloc_page_from(struct mm_zone *zone)
         return (&zone->pages[page_ndx]);
 }
 
-struct mm_page *mm_alloc_page(void)
+static struct mm_page *alloc_from_any_zone(void)
 {
         /* For now, just get a page from any zone. */
-        struct mm_page *p = NULL;
         SLIST_FOREACH (it, slist_next(&MM_ZONES)) {
                 struct mm_zone *z = container_of(it, struct mm_zone, sys_zones);
-                p = mm_alloc_page_from(z);
+                struct mm_page *p = mm_alloc_page_from(z);
                 if (p != NULL) {
-                        break;
+                        return (p);
+                }
+        }
+
+        return (NULL);
+}
+
+struct mm_page *mm_alloc_page(void)
+{
+        /* Start reclaiming before the memory actually runs out. */
+        if (__unlikely(FREE_PAGES < CONF_MM_LOW_WATERMARK_PAGES)) {
+                deferred_schedule(&RECLAIM_WORK);
+        }
+
+        struct mm_page *p = alloc_from_any_zone();
+
+        /* There is no other way to get a page. The shrinkers skip whatever is being updated. */
+        for (unsigned prio = SHRINKER_PRIORITY_DEFAULT; p == NULL && prio > 0; prio--) {
+                if (shrinkers_run(prio - 1) > 0) {
+                        p = alloc_from_any_zone();
                 }
         }
 
@@ -140,6 +190,7 @@ struct mm_page *mm_alloc_page(void)
                 return (NULL);
         }
 
+        FREE_PAGES--;
         p->state = PAGESTATE_OCCUPIED;
         return (p);
 }
@@ -204,7 +255,9 @@ void mm_free_page(phys_addr_t addr)
 
         kassert(!buddy_is_free(zone->buddym, page_ndx));
         kassert(zone->pages[page_ndx].state == PAGESTATE_OCCUPIED);
+        kassert(zone->pages[page_ndx].lru_state == PAGELRU_NONE);
 
         buddy_free(zone->buddym, page_ndx, 0);
         zone->pages[page_ndx].state = PAGESTATE_FREE;
+        FREE_PAGES++;
 }
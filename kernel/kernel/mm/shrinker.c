@@ -0,0 +1,67 @@
+#include "kernel/mm/shrinker.h"
+
+#include "lib/cstd/assert.h"
+#include "lib/ds/slist.h"
+#include "lib/utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Sorted by seeks. */
+static struct slist_ref SHRINKERS;
+static bool RUNNING = false;
+
+void shrinker_register(struct shrinker *s)
+{
+        kassert(s != NULL);
+        kassert(s->count != NULL && s->scan != NULL);
+
+        /* Subsystems may be reinitialized. */
+        SLIST_FOREACH (it, slist_next(&SHRINKERS)) {
+                if (it == &s->list) {
+                        return;
+                }
+        }
+
+        struct slist_ref *prev = &SHRINKERS;
+        while (slist_next(prev) != NULL) {
+                struct shrinker *next = container_of(slist_next(prev), struct shrinker, list);
+                if (next->seeks > s->seeks) {
+                        break;
+                }
+                prev = slist_next(prev);
+        }
+
+        slist_insert(prev, &s->list);
+}
+
+void shrinker_unregister(struct shrinker *s)
+{
+        kassert(s != NULL);
+        slist_remove(&SHRINKERS, &s->list);
+}
+
+size_t shrinkers_run(unsigned priority)
+{
+        /* Shrinkers free memory, which may put the memory under pressure once again. */
+        if (RUNNING) {
+                return (0);
+        }
+        RUNNING = true;
+
+        size_t freed = 0;
+        SLIST_FOREACH (it, slist_next(&SHRINKERS)) {
+                struct shrinker *s = container_of(it, struct shrinker, list);
+
+                size_t const count = s->count(s);
+                if (count == 0) {
+                        continue;
+                }
+
+                size_t nr = count >> priority;
+                freed += s->scan(s, nr > 0 ? nr : 1);
+        }
+
+        RUNNING = false;
+        return (freed);
+}
@@ -0,0 +1,212 @@
+#include "kernel/mm/swap.h"
+
+#include "kernel/blkdev.h"
+#include "kernel/config.h"
+#include "kernel/deferred.h"
+#include "kernel/klog.h"
+#include "kernel/mm/kmalloc.h"
+#include "kernel/mm/kmm.h"
+#include "kernel/mm/mempool.h"
+#include "kernel/mm/zstore.h"
+#include "kernel/platform_consts.h"
+
+#include "lib/cppdefs.h"
+#include "lib/cstd/assert.h"
+#include "lib/ds/bitmap.h"
+#include "lib/ds/rbtree.h"
+#include "lib/utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct swap_entry {
+        struct rbtree_node node;
+        void const *key;
+        size_t slot;
+};
+
+static struct {
+        struct blkdev *dev;
+        struct bitmap slots; /**< Occupied blocks of the device. */
+        struct kmm_cache *entry_cache; /**< Shares slabs with the heap buffers. */
+        /* Pages are swapped out from the reclaim, which must not allocate. */
+        struct mempool entry_pool;
+        void *entry_reserve[CONF_SWAP_RESERVED_ENTRIES];
+        struct rbtree entries;
+        size_t entries_count;
+} SWAP;
+
+static int entry_cmp(void const *tree_entry, void const *entry)
+{
+        uintptr_t const x = (uintptr_t)((struct swap_entry const *)tree_entry)->key;
+        uintptr_t const y = (uintptr_t)((struct swap_entry const *)entry)->key;
+        return (x < y ? -1 : x > y);
+}
+
+static int entry_key_cmp(void const *tree_entry, void const *key)
+{
+        uintptr_t const x = (uintptr_t)((struct swap_entry const *)tree_entry)->key;
+        uintptr_t const y = (uintptr_t)key;
+        return (x < y ? -1 : x > y);
+}
+
+static struct swap_entry *find_entry(void const *key)
+{
+        if (SWAP.entries_count == 0) {
+                return (NULL);
+        }
+
+        struct rbtree_node *node = rbtree_search(&SWAP.entries, (void *)(uintptr_t)key,
+                                                 entry_key_cmp);
+        return (node != NULL ? node->data : NULL);
+}
+
+static void delete_entry(struct swap_entry *e)
+{
+        rbtree_delete(&SWAP.entries, &e->node);
+        SWAP.entries_count--;
+        bitmap_set_false(&SWAP.slots, e->slot);
+        if (SWAP.dev->discard != NULL) {
+                SWAP.dev->discard(SWAP.dev, e->slot);
+        }
+        mempool_free(&SWAP.entry_pool, e);
+}
+
+static void refill_reserve(void)
+{
+        if (__unlikely(!mempool_refill(&SWAP.entry_pool))) {
+                LOGF_W("Couldn't refill the reserve of swap entries.\n");
+        }
+}
+
+static struct deferred_work REFILL_WORK = {
+        .name = "swap_refill",
+        .fn = refill_reserve,
+};
+
+static bool init_device(struct blkdev *dev)
+{
+        if (dev->block_size != PLATFORM_PAGE_SIZE) {
+                LOGF_E("The swap device %s doesn't have page-sized blocks\n", dev->name);
+                return (false);
+        }
+
+        void *slots_mem = kmalloc(bitmap_predict_size(dev->blocks_count));
+        if (__unlikely(slots_mem == NULL)) {
+                return (false);
+        }
+        bitmap_init(&SWAP.slots, slots_mem, dev->blocks_count);
+
+        mempool_init(&SWAP.entry_pool, SWAP.entry_reserve, ARRAY_SIZE(SWAP.entry_reserve),
+                     mempool_alloc_slab, mempool_free_slab, SWAP.entry_cache);
+        refill_reserve();
+        deferred_register(&REFILL_WORK);
+
+        return (true);
+}
+
+void swap_init(struct blkdev *dev)
+{
+        zstore_init();
+
+        rbtree_init_tree(&SWAP.entries);
+        SWAP.entries_count = 0;
+        SWAP.dev = NULL;
+
+        /* The cache is there even without a device, so the heap buffers always share it. */
+        if (SWAP.entry_cache == NULL) {
+                SWAP.entry_cache = kmm_cache_create("swap_entries", sizeof(struct swap_entry), 0,
+                                                    KMM_CACHE_MERGEABLE, NULL, NULL);
+        }
+        if (__unlikely(SWAP.entry_cache == NULL)) {
+                LOGF_P("Couldn't create the cache for swap entries.\n");
+        }
+
+        if (dev == NULL) {
+                LOGF_W("There is no swap device. Only the compressed store is used.\n");
+                return;
+        }
+
+        if (!init_device(dev)) {
+                LOGF_E("Couldn't use %s as the swap device\n", dev->name);
+                return;
+        }
+        SWAP.dev = dev;
+}
+
+static bool write_to_device(void const *key, void const *page)
+{
+        if (SWAP.dev == NULL) {
+                return (false);
+        }
+
+        size_t slot = 0;
+        if (!bitmap_search_false(&SWAP.slots, &slot)) {
+                return (false);
+        }
+
+        struct swap_entry *e = mempool_alloc_reserved(&SWAP.entry_pool);
+        deferred_schedule(&REFILL_WORK);
+        if (__unlikely(e == NULL)) {
+                return (false);
+        }
+
+        if (__unlikely(SWAP.dev->write(SWAP.dev, slot, page) != BLKDEV_RC_OK)) {
+                LOGF_E("Couldn't write to the swap device %s\n", SWAP.dev->name);
+                mempool_free(&SWAP.entry_pool, e);
+                return (false);
+        }
+        bitmap_set_true(&SWAP.slots, slot);
+
+        e->key = key;
+        e->slot = slot;
+        rbtree_init_node(&e->node);
+        e->node.data = e;
+        rbtree_insert(&SWAP.entries, &e->node, entry_cmp);
+        SWAP.entries_count++;
+
+        return (true);
+}
+
+bool swap_out(void const *key, void const *page)
+{
+        kassert(!swap_contains(key));
+
+        if (zstore_store(key, page)) {
+                return (true);
+        }
+        return (write_to_device(key, page));
+}
+
+bool swap_contains(void const *key)
+{
+        return (zstore_contains(key) || find_entry(key) != NULL);
+}
+
+void swap_in(void const *key, void *page)
+{
+        if (zstore_contains(key)) {
+                zstore_load(key, page);
+                return;
+        }
+
+        struct swap_entry *e = find_entry(key);
+        kassert(e != NULL);
+
+        if (__unlikely(SWAP.dev->read(SWAP.dev, e->slot, page) != BLKDEV_RC_OK)) {
+                LOGF_P("Couldn't read the page %p from the swap device %s\n", key, SWAP.dev->name);
+        }
+
+        delete_entry(e);
+}
+
+void swap_drop(void const *key)
+{
+        zstore_drop(key);
+
+        struct swap_entry *e = find_entry(key);
+        if (e != NULL) {
+                delete_entry(e);
+        }
+}
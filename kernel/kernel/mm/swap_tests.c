@@ -0,0 +1,233 @@
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/swap.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/zstore.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/mempool.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/kmm.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/shrinker.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/deferred.c
+// UNITY_TEST DEPENDS ON: kernel/lib/compress/lz.c
+// UNITY_TEST DEPENDS ON: kernel/lib/cstd/string/memcpy.c
+// UNITY_TEST DEPENDS ON: kernel/lib/cstd/string/memset.c
+// UNITY_TEST DEPENDS ON: kernel/lib/ds/bitmap.c
+// UNITY_TEST DEPENDS ON: kernel/lib/ds/rbtree.c
+// UNITY_TEST DEPENDS ON: kernel/lib/ds/slist.c
+// UNITY_TEST DEPENDS ON: kernel/test_fakes/panic.c
+
+#include "kernel/mm/swap.h"
+
+#include "kernel/blkdev.h"
+#include "kernel/config.h"
+#include "kernel/deferred.h"
+#include "kernel/mm/kmalloc.h"
+#include "kernel/mm/kmm.h"
+#include "kernel/mm/zstore.h"
+
+#include "lib/ds/rbtree.h"
+#include "lib/utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+size_t const PLATFORM_PAGE_SIZE = 4096;
+
+#define PAGE_SIZE    (4096)
+#define DISK_BLOCKS  (64)
+#define KEY(N)       ((void *)(((N) + 1) * PAGE_SIZE))
+#define STORED_PAGES (CONF_ZSTORE_RESERVED_ENTRIES + CONF_SWAP_RESERVED_ENTRIES)
+
+static size_t PAGES_ALLOCATED = 0;
+
+static void *alloc_page(void)
+{
+        PAGES_ALLOCATED++;
+        return (aligned_alloc(PLATFORM_PAGE_SIZE, PLATFORM_PAGE_SIZE));
+}
+
+static void free_page(void *mem)
+{
+        free(mem);
+}
+
+void *kmalloc(size_t size)
+{
+        return (malloc(size));
+}
+
+void kfree(void *mem)
+{
+        free(mem);
+}
+
+static uint8_t DISK[DISK_BLOCKS][PAGE_SIZE];
+static size_t WRITES = 0;
+static size_t DISCARDS = 0;
+
+static int disk_read(struct blkdev *dev __unused, size_t block, void *buf)
+{
+        memcpy(buf, DISK[block], PAGE_SIZE);
+        return (BLKDEV_RC_OK);
+}
+
+static int disk_write(struct blkdev *dev __unused, size_t block, void const *buf)
+{
+        WRITES++;
+        memcpy(DISK[block], buf, PAGE_SIZE);
+        return (BLKDEV_RC_OK);
+}
+
+static void disk_discard(struct blkdev *dev __unused, size_t block)
+{
+        DISCARDS++;
+        memset(DISK[block], 0x0, PAGE_SIZE);
+}
+
+static struct blkdev DEV = {
+        .name = "test_disk",
+        .block_size = PAGE_SIZE,
+        .blocks_count = DISK_BLOCKS,
+        .read = disk_read,
+        .write = disk_write,
+        .discard = disk_discard,
+};
+
+static uint8_t PAGE[PAGE_SIZE];
+static uint8_t BUFFER[PAGE_SIZE];
+
+static void fill_compressible(unsigned seed)
+{
+        memset(PAGE, (int)seed, sizeof(PAGE));
+}
+
+static void fill_random(unsigned seed)
+{
+        srand(seed);
+        for (size_t i = 0; i < sizeof(PAGE); i++) {
+                PAGE[i] = (uint8_t)rand();
+        }
+}
+
+void setUp(void)
+{
+        WRITES = 0;
+        DISCARDS = 0;
+}
+
+void tearDown(void)
+{
+        for (size_t i = 0; i <= STORED_PAGES; i++) {
+                swap_drop(KEY(i));
+        }
+        deferred_run();
+}
+
+static void compressible_page_kept_in_memory(void)
+{
+        fill_compressible(0xAB);
+        TEST_ASSERT_TRUE(swap_out(KEY(0), PAGE));
+        TEST_ASSERT_TRUE(swap_contains(KEY(0)));
+        TEST_ASSERT_EQUAL_size_t(1, zstore_pages());
+        TEST_ASSERT_EQUAL_size_t(0, WRITES);
+
+        swap_in(KEY(0), BUFFER);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(PAGE, BUFFER, PAGE_SIZE);
+        TEST_ASSERT_FALSE(swap_contains(KEY(0)));
+        TEST_ASSERT_EQUAL_size_t(0, zstore_pages());
+}
+
+static void incompressible_page_written_out(void)
+{
+        fill_random(42);
+        TEST_ASSERT_TRUE(swap_out(KEY(0), PAGE));
+        TEST_ASSERT_TRUE(swap_contains(KEY(0)));
+        TEST_ASSERT_EQUAL_size_t(0, zstore_pages());
+        TEST_ASSERT_EQUAL_size_t(1, WRITES);
+
+        swap_in(KEY(0), BUFFER);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(PAGE, BUFFER, PAGE_SIZE);
+        TEST_ASSERT_FALSE(swap_contains(KEY(0)));
+        TEST_ASSERT_EQUAL_size_t(1, DISCARDS);
+}
+
+static void dropped_block_reused(void)
+{
+        fill_random(1);
+        TEST_ASSERT_TRUE(swap_out(KEY(0), PAGE));
+        swap_drop(KEY(0));
+        TEST_ASSERT_FALSE(swap_contains(KEY(0)));
+        TEST_ASSERT_EQUAL_size_t(1, DISCARDS);
+
+        fill_random(2);
+        TEST_ASSERT_TRUE(swap_out(KEY(1), PAGE));
+        swap_in(KEY(1), BUFFER);
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(PAGE, BUFFER, PAGE_SIZE);
+}
+
+static void swap_out_never_allocates(void)
+{
+        size_t const allocated = PAGES_ALLOCATED;
+
+        /* The compressed store takes what its reserve allows, then the device does the same. */
+        for (size_t i = 0; i < STORED_PAGES; i++) {
+                fill_compressible((unsigned)i);
+                TEST_ASSERT_TRUE(swap_out(KEY(i), PAGE));
+        }
+        TEST_ASSERT_EQUAL_size_t(CONF_ZSTORE_RESERVED_ENTRIES, zstore_pages());
+        TEST_ASSERT_EQUAL_size_t(CONF_SWAP_RESERVED_ENTRIES, WRITES);
+
+        fill_compressible(0xFF);
+        TEST_ASSERT_FALSE(swap_out(KEY(STORED_PAGES), PAGE));
+        TEST_ASSERT_EQUAL_size_t(allocated, PAGES_ALLOCATED);
+
+        /* The reserves are refilled outside of the reclaim. */
+        deferred_run();
+        TEST_ASSERT_TRUE(swap_out(KEY(STORED_PAGES), PAGE));
+
+        for (size_t i = 0; i <= STORED_PAGES; i++) {
+                fill_compressible(i < STORED_PAGES ? (unsigned)i : 0xFF);
+                swap_in(KEY(i), BUFFER);
+                TEST_ASSERT_EQUAL_HEX8_ARRAY(PAGE, BUFFER, PAGE_SIZE);
+        }
+}
+
+/* The layout of the heap buffers. Their cache is set up before kmm_init(), as the heap's is. */
+struct heap_buffer {
+        struct rbtree_node node;
+        void *base;
+        size_t pages;
+};
+static struct kmm_cache HEAP_BUFFERS;
+
+static void entries_share_slabs(void)
+{
+        TEST_ASSERT_NOT_NULL(HEAP_BUFFERS.merged_into);
+        TEST_ASSERT_EQUAL_size_t(2, HEAP_BUFFERS.merged_into->merged_users);
+
+        size_t const allocated = PAGES_ALLOCATED;
+        void *buffer = kmm_cache_alloc(&HEAP_BUFFERS);
+        TEST_ASSERT_NOT_NULL(buffer);
+        TEST_ASSERT_EQUAL_size_t(1, HEAP_BUFFERS.stats.active_objects);
+        TEST_ASSERT_EQUAL_size_t(0, HEAP_BUFFERS.stats.active_slabs);
+        /* The swap entries have a partial slab already. */
+        TEST_ASSERT_EQUAL_size_t(allocated, PAGES_ALLOCATED);
+        kmm_cache_free(&HEAP_BUFFERS, buffer);
+}
+
+int main(void)
+{
+        kmm_cache_init(&HEAP_BUFFERS, "heap_buffers", sizeof(struct heap_buffer), 0,
+                       KMM_CACHE_MERGEABLE, NULL, NULL);
+        kmm_init(alloc_page, free_page);
+        swap_init(&DEV);
+
+        UNITY_BEGIN();
+        RUN_TEST(compressible_page_kept_in_memory);
+        RUN_TEST(incompressible_page_written_out);
+        RUN_TEST(dropped_block_reused);
+        RUN_TEST(swap_out_never_allocates);
+        RUN_TEST(entries_share_slabs);
+        UNITY_END();
+        return (0);
+}
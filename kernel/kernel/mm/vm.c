@@ -13,18 +13,20 @@
 #include "lib/cstd/string.h"
 #include "lib/ds/rbtree.h"
 #include "lib/ds/slist.h"
+#include "lib/utils.h"
 
 static struct kmm_cache AREAS_CACHE = { 0 };
 
-void vm_pgfault_handle_panic(struct vm_area *area, void *addr)
+void vm_pgfault_handle_panic(struct vm_area *area, void *addr, enum vm_fault_flags fault)
 {
-        LOGF_P("Page fault at the address %p inside area %p-%p!\n", addr, area->base,
+        LOGF_P("Page fault (%#x) at the address %p inside area %p-%p!\n", fault, addr, area->base,
                (void *)((uintptr_t)area->base + area->length - 1));
 }
 
 void vm_init(void)
 {
-        kmm_cache_init(&AREAS_CACHE, "areas", sizeof(struct vm_area), 0, 0, NULL, NULL);
+        kmm_cache_init(&AREAS_CACHE, "areas", sizeof(struct vm_area), 0, KMM_CACHE_MERGEABLE,
+                       NULL, NULL);
 }
 
 struct find_data {
@@ -45,6 +47,14 @@ struct vm_area *vm_new_area_within_space(struct vm_space *space, size_t const mi
         kassert(space != NULL);
         kassert(min_size <= max_size);
 
+        /* The allocation may need a new area itself, so it can't be done under the lock. */
+        struct vm_area *new_area = kmm_cache_alloc(&AREAS_CACHE);
+        if (__unlikely(new_area == NULL)) {
+                return (NULL);
+        }
+
+        vm_space_lock(space);
+
         kassert(sizeof(min_size) == sizeof(void *));
         size_t gap_len = 0;
         struct find_data fdata = {.offset = space->offset, .len = min_size};
@@ -52,14 +62,14 @@ struct vm_area *vm_new_area_within_space(struct vm_space *space, size_t const mi
 
         size_t const occupy_len = MIN(max_size, gap_len);
 
-        struct vm_area *new_area = kmm_cache_alloc(&AREAS_CACHE);
-        if (__unlikely(new_area == NULL)) {
-                return (NULL);
-        }
-
         vm_area_init(new_area, gap_base, occupy_len, space);
         vm_space_insert_area(space, new_area);
 
+        vm_space_unlock(space);
+
+        /* The new area is going to be populated soon. */
+        vm_arch_pt_pool_refill();
+
         return (new_area);
 }
 
@@ -67,6 +77,128 @@ void vm_free_area(struct vm_area *area)
 {
         kassert(area != NULL);
 
-        vm_space_remove_area(area->owner, area);
+        struct vm_space *space = area->owner;
+        vm_space_lock(space);
+        vm_space_remove_area(space, area);
+        vm_space_unlock(space);
+
         kmm_cache_free(&AREAS_CACHE, area);
 }
+
+static bool areas_mergeable(struct vm_area const *area, struct vm_area const *next)
+{
+        struct vm_area_ops const *x = &area->ops;
+        struct vm_area_ops const *y = &next->ops;
+
+        bool const same_ops = x->handle_pg_fault == y->handle_pg_fault &&
+                              x->register_map == y->register_map &&
+                              x->unregister_map == y->unregister_map && x->merge == y->merge &&
+                              x->split_prepare == y->split_prepare && x->split == y->split &&
+                              x->release == y->release;
+
+        return (x->merge != NULL && same_ops && area->flags == next->flags);
+}
+
+static void release_garbage(struct vm_area *area, struct slist_ref *garbage)
+{
+        if (!slist_is_empty(garbage)) {
+                kassert(area->ops.release != NULL);
+                area->ops.release(garbage);
+        }
+}
+
+/* Must be called under the space lock. The caller frees the next area on success. */
+static bool try_absorb_next(struct vm_area *area, struct vm_area *next, struct slist_ref *garbage)
+{
+        if (next == NULL || !areas_mergeable(area, next)) {
+                return (false);
+        }
+
+        if (!area->ops.merge(area, next, garbage)) {
+                return (false);
+        }
+
+        vm_space_merge_areas(area->owner, area, next);
+
+        return (true);
+}
+
+struct vm_area *vm_merge_area(struct vm_area *area)
+{
+        kassert(area != NULL);
+
+        /* Freeing may give memory back to the space, so nothing is freed under the lock. */
+        struct vm_area *absorbed[2] = { NULL, NULL };
+        struct slist_ref garbage;
+        slist_init(&garbage);
+
+        struct vm_space *space = area->owner;
+        vm_space_lock(space);
+
+        struct vm_area *prev = vm_space_prev_adjacent(space, area);
+        if (prev != NULL && try_absorb_next(prev, area, &garbage)) {
+                absorbed[0] = area;
+                area = prev;
+        }
+
+        struct vm_area *next = vm_space_next_adjacent(space, area);
+        if (try_absorb_next(area, next, &garbage)) {
+                absorbed[1] = next;
+        }
+
+        vm_space_unlock(space);
+
+        release_garbage(area, &garbage);
+        for (size_t i = 0; i < ARRAY_SIZE(absorbed); i++) {
+                if (absorbed[i] != NULL) {
+                        kmm_cache_free(&AREAS_CACHE, absorbed[i]);
+                }
+        }
+
+        return (area);
+}
+
+struct vm_area *vm_split_area(struct vm_area *area, size_t offset)
+{
+        kassert(area != NULL);
+        kassert(offset > 0 && offset < area->length);
+        kassert(check_align(offset, PLATFORM_PAGE_SIZE));
+
+        if (area->ops.split == NULL) {
+                return (NULL);
+        }
+
+        struct vm_area *tail = kmm_cache_alloc(&AREAS_CACHE);
+        if (__unlikely(tail == NULL)) {
+                return (NULL);
+        }
+
+        void *const tail_base = (void *)((uintptr_t)area->base + offset);
+        vm_area_init(tail, tail_base, area->length - offset, area->owner);
+        tail->flags = area->flags;
+        tail->ops = area->ops;
+
+        /* Whatever the split needs is allocated before the lock is taken. */
+        if (area->ops.split_prepare != NULL && !area->ops.split_prepare(area, tail)) {
+                kmm_cache_free(&AREAS_CACHE, tail);
+                return (NULL);
+        }
+
+        struct slist_ref garbage;
+        slist_init(&garbage);
+
+        vm_space_lock(area->owner);
+        bool const split = area->ops.split(area, tail, &garbage);
+        if (split) {
+                vm_space_split_area(area->owner, area, tail);
+        }
+        vm_space_unlock(area->owner);
+
+        release_garbage(area, &garbage);
+        if (!split) {
+                kmm_cache_free(&AREAS_CACHE, tail);
+                return (NULL);
+        }
+
+        return (tail);
+}
@@ -5,7 +5,10 @@
 #include "kernel/platform_consts.h"
 
 #include "lib/cstd/assert.h"
+#include "lib/ds/rbtree.h"
 #include "lib/ds/slist.h"
+#include "lib/sync/seqcount.h"
+#include "lib/sync/spinlock.h"
 #include "lib/utils.h"
 
 #include <stddef.h>
@@ -15,6 +18,7 @@ void *vm_space_find_gap(struct vm_space *space, size_t *result_len,
 {
         kassert(space != NULL);
         kassert(predicate != NULL);
+        kassert(spinlock_is_locked(&space->lock));
 
         uintptr_t next_after_last_area = space->offset;
 
@@ -58,11 +62,56 @@ void vm_space_init(struct vm_space *space, phys_addr_t root_pdir, uintptr_t offs
         rbtree_init_tree(&space->rb_areas);
         space->root_dir = root_pdir;
         space->offset = offset;
+        spinlock_init(&space->lock);
+        seqcount_init(&space->areas_seq);
+}
+
+void vm_space_lock(struct vm_space *space)
+{
+        spinlock_lock(&space->lock);
+}
+
+void vm_space_unlock(struct vm_space *space)
+{
+        kassert(spinlock_is_locked(&space->lock));
+        spinlock_unlock(&space->lock);
+}
+
+/* A red-black tree can't be deeper than 2 * log2(n + 1). */
+#define RBTREE_MAX_DEPTH (2 * sizeof(uintptr_t) * 8)
+
+struct vm_area *vm_space_find_area(struct vm_space *space, void const *addr)
+{
+        kassert(space != NULL);
+
+        struct vm_area *found = NULL;
+        unsigned seq = 0;
+        do {
+                seq = seqcount_read_begin(&space->areas_seq);
+                found = NULL;
+
+                struct rbtree_node *node = __atomic_load_n(&space->rb_areas.root, __ATOMIC_RELAXED);
+                /* The search may go in circles if it races with a rotation.
+                 * The depth limit breaks out of them, the retry will fix the result. */
+                for (size_t depth = 0; node != NULL && depth < RBTREE_MAX_DEPTH; depth++) {
+                        int const c = vm_area_rbtcmpfn_area_to_addr(node->data, addr);
+                        if (c == 0) {
+                                found = node->data;
+                                break;
+                        }
+
+                        node = c > 0 ? __atomic_load_n(&node->left, __ATOMIC_RELAXED) :
+                                       __atomic_load_n(&node->right, __ATOMIC_RELAXED);
+                }
+        } while (seqcount_read_retry(&space->areas_seq, seq));
+
+        return (found);
 }
 
 void vm_space_insert_area(struct vm_space *space, struct vm_area *area)
 {
         kassert(space != NULL);
+        kassert(spinlock_is_locked(&space->lock));
 
         kassert(space->offset <= (uintptr_t)area->base);
 
@@ -70,7 +119,9 @@ void vm_space_insert_area(struct vm_space *space, struct vm_area *area)
                 rbtree_search_max(&space->rb_areas, area, vm_area_rbtcmpfn);
         struct vm_area *left_neigh = left_neigh_node != NULL ? left_neigh_node->data : NULL;
 
+        seqcount_write_begin(&space->areas_seq);
         rbtree_insert(&space->rb_areas, &area->rb_areas, vm_area_rbtcmpfn);
+        seqcount_write_end(&space->areas_seq);
 
         if (left_neigh == NULL) {
                 slist_insert(&space->sorted_areas, &area->sorted_areas);
@@ -83,7 +134,74 @@ void vm_space_remove_area(struct vm_space *space, struct vm_area *area)
 {
         kassert(space != NULL);
         kassert(area != NULL);
+        kassert(spinlock_is_locked(&space->lock));
 
+        seqcount_write_begin(&space->areas_seq);
         rbtree_delete(&space->rb_areas, &area->rb_areas);
+        seqcount_write_end(&space->areas_seq);
+
         slist_remove(&space->sorted_areas, &area->sorted_areas);
 }
+
+struct vm_area *vm_space_prev_adjacent(struct vm_space *space, struct vm_area *area)
+{
+        kassert(space != NULL);
+        kassert(area != NULL);
+        kassert(spinlock_is_locked(&space->lock));
+
+        uintptr_t const before = (uintptr_t)area->base - 1;
+        struct rbtree_node *prev =
+                rbtree_search(&space->rb_areas, (void *)before, vm_area_rbtcmpfn_area_to_addr);
+
+        return (prev != NULL ? prev->data : NULL);
+}
+
+struct vm_area *vm_space_next_adjacent(struct vm_space *space, struct vm_area *area)
+{
+        kassert(space != NULL);
+        kassert(area != NULL);
+        kassert(spinlock_is_locked(&space->lock));
+
+        struct slist_ref *next_ref = slist_next(&area->sorted_areas);
+        if (next_ref == NULL) {
+                return (NULL);
+        }
+
+        struct vm_area *next = container_of(next_ref, struct vm_area, sorted_areas);
+        if ((uintptr_t)area->base + area->length != (uintptr_t)next->base) {
+                return (NULL);
+        }
+
+        return (next);
+}
+
+void vm_space_merge_areas(struct vm_space *space, struct vm_area *area, struct vm_area *next)
+{
+        kassert(space != NULL);
+        kassert(spinlock_is_locked(&space->lock));
+        kassert(slist_next(&area->sorted_areas) == &next->sorted_areas);
+        kassert((uintptr_t)area->base + area->length == (uintptr_t)next->base);
+
+        /* The tree is ordered by bases, so the area keeps its position. */
+        seqcount_write_begin(&space->areas_seq);
+        rbtree_delete(&space->rb_areas, &next->rb_areas);
+        area->length += next->length;
+        seqcount_write_end(&space->areas_seq);
+
+        slist_remove_next(&area->sorted_areas);
+}
+
+void vm_space_split_area(struct vm_space *space, struct vm_area *area, struct vm_area *tail)
+{
+        kassert(space != NULL);
+        kassert(spinlock_is_locked(&space->lock));
+        kassert((uintptr_t)tail->base > (uintptr_t)area->base);
+        kassert((uintptr_t)tail->base + tail->length == (uintptr_t)area->base + area->length);
+
+        seqcount_write_begin(&space->areas_seq);
+        area->length = (uintptr_t)tail->base - (uintptr_t)area->base;
+        rbtree_insert(&space->rb_areas, &tail->rb_areas, vm_area_rbtcmpfn);
+        seqcount_write_end(&space->areas_seq);
+
+        slist_insert(&area->sorted_areas, &tail->sorted_areas);
+}
@@ -0,0 +1,314 @@
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/vm.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/vm_space.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/vm_area.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/dev.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/kmm.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/deferred.c
+// UNITY_TEST DEPENDS ON: kernel/kernel/mm/shrinker.c
+// UNITY_TEST DEPENDS ON: kernel/lib/cstd/string/memset.c
+// UNITY_TEST DEPENDS ON: kernel/lib/ds/rbtree.c
+// UNITY_TEST DEPENDS ON: kernel/lib/ds/slist.c
+// UNITY_TEST DEPENDS ON: kernel/test_fakes/panic.c
+
+#include "kernel/mm/dev.h"
+#include "kernel/mm/kmm.h"
+#include "kernel/mm/vm.h"
+#include "kernel/mm/vm_area.h"
+#include "kernel/mm/vm_space.h"
+#include "kernel/resources.h"
+
+#include "lib/ds/slist.h"
+#include "lib/sync/spinlock.h"
+#include "lib/utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unity.h>
+
+size_t const PLATFORM_PAGE_SIZE = 4096;
+
+#define PAGES(N) ((N)*PLATFORM_PAGE_SIZE)
+
+static size_t MAPPED_PAGES = 0;
+
+void vm_arch_pt_pool_refill(void) {}
+
+bool vm_arch_is_range_valid(void const *base __unused, size_t len __unused)
+{
+        return (true);
+}
+
+void vm_arch_pt_map(void *tree_root __unused, const void *phys_addr __unused,
+                    const void *at_virt_addr __unused, enum vm_flags flags __unused)
+{
+        MAPPED_PAGES++;
+}
+
+void vm_arch_pt_unmap_range(void *tree_root __unused, void *virt_addr __unused, size_t pages)
+{
+        MAPPED_PAGES -= pages;
+}
+
+static void *alloc_page(void)
+{
+        return (aligned_alloc(PLATFORM_PAGE_SIZE, PLATFORM_PAGE_SIZE));
+}
+
+static void free_page(void *mem)
+{
+        free(mem);
+}
+
+static struct vm_space SPACE;
+static uint32_t ROOT_DIR;
+
+/* Generic owner that tracks what it has been asked to do. */
+static struct slist_ref LEFTOVERS[3];
+static size_t LEFTOVERS_USED = 0;
+static size_t PREPARED = 0;
+static size_t RELEASED = 0;
+
+static bool test_merge(struct vm_area *area __unused, struct vm_area *next __unused,
+                       struct slist_ref *garbage)
+{
+        TEST_ASSERT_TRUE(spinlock_is_locked(&SPACE.lock));
+        struct slist_ref *leftover = &LEFTOVERS[LEFTOVERS_USED++];
+        slist_init(leftover);
+        slist_insert(garbage, leftover);
+        return (true);
+}
+
+static bool test_split_prepare(struct vm_area *area __unused, struct vm_area *tail)
+{
+        TEST_ASSERT_FALSE(spinlock_is_locked(&SPACE.lock));
+        PREPARED++;
+        tail->data = &LEFTOVERS[LEFTOVERS_USED++];
+        return (true);
+}
+
+static bool test_split(struct vm_area *area __unused, struct vm_area *tail,
+                       struct slist_ref *garbage)
+{
+        TEST_ASSERT_TRUE(spinlock_is_locked(&SPACE.lock));
+        struct slist_ref *leftover = tail->data;
+        TEST_ASSERT_NOT_NULL(leftover);
+        slist_init(leftover);
+        slist_insert(garbage, leftover);
+        tail->data = NULL;
+        return (true);
+}
+
+static void test_release(struct slist_ref *garbage)
+{
+        TEST_ASSERT_FALSE(spinlock_is_locked(&SPACE.lock));
+        while (!slist_is_empty(garbage)) {
+                slist_remove_next(garbage);
+                RELEASED++;
+        }
+}
+
+static struct vm_area_ops const TEST_OPS = {
+        .handle_pg_fault = vm_pgfault_handle_panic,
+        .merge = test_merge,
+        .split_prepare = test_split_prepare,
+        .split = test_split,
+        .release = test_release,
+};
+
+static size_t count_areas(void)
+{
+        size_t count = 0;
+        SLIST_FOREACH (it, slist_next(&SPACE.sorted_areas)) {
+                count++;
+        }
+        return (count);
+}
+
+void setUp(void)
+{
+        vm_space_init(&SPACE, (phys_addr_t)&ROOT_DIR, PLATFORM_PAGE_SIZE);
+        LEFTOVERS_USED = 0;
+        PREPARED = 0;
+        RELEASED = 0;
+        MAPPED_PAGES = 0;
+}
+
+void tearDown(void)
+{
+        TEST_ASSERT_FALSE(spinlock_is_locked(&SPACE.lock));
+        struct slist_ref *it;
+        while ((it = slist_next(&SPACE.sorted_areas)) != NULL) {
+                vm_free_area(container_of(it, struct vm_area, sorted_areas));
+        }
+}
+
+static void split_and_merge(void)
+{
+        struct vm_area *area = vm_new_area_within_space(&SPACE, PAGES(4), PAGES(4));
+        TEST_ASSERT_NOT_NULL(area);
+        area->ops = TEST_OPS;
+
+        struct vm_area *tail = vm_split_area(area, PAGES(1));
+        TEST_ASSERT_NOT_NULL(tail);
+        TEST_ASSERT_EQUAL_size_t(1, PREPARED);
+        TEST_ASSERT_EQUAL_size_t(1, RELEASED);
+        TEST_ASSERT_EQUAL_size_t(PAGES(1), area->length);
+        TEST_ASSERT_EQUAL_size_t(PAGES(3), tail->length);
+        TEST_ASSERT_EQUAL_PTR((uint8_t *)area->base + PAGES(1), tail->base);
+        TEST_ASSERT_EQUAL_PTR(tail, vm_space_find_area(&SPACE, tail->base));
+        TEST_ASSERT_EQUAL_size_t(2, count_areas());
+
+        /* The tail is absorbed by the area in front of it. */
+        TEST_ASSERT_EQUAL_PTR(area, vm_merge_area(tail));
+        TEST_ASSERT_EQUAL_size_t(2, RELEASED);
+        TEST_ASSERT_EQUAL_size_t(PAGES(4), area->length);
+        TEST_ASSERT_EQUAL_PTR(area, vm_space_find_area(&SPACE, (uint8_t *)area->base + PAGES(3)));
+        TEST_ASSERT_EQUAL_size_t(1, count_areas());
+}
+
+static void merge_both_neighbours(void)
+{
+        struct vm_area *areas[3];
+        for (size_t i = 0; i < ARRAY_SIZE(areas); i++) {
+                areas[i] = vm_new_area_within_space(&SPACE, PAGES(1), PAGES(1));
+                TEST_ASSERT_NOT_NULL(areas[i]);
+                areas[i]->ops = TEST_OPS;
+        }
+
+        TEST_ASSERT_EQUAL_PTR(areas[0], vm_merge_area(areas[1]));
+        TEST_ASSERT_EQUAL_size_t(2, RELEASED);
+        TEST_ASSERT_EQUAL_size_t(PAGES(3), areas[0]->length);
+        TEST_ASSERT_EQUAL_size_t(1, count_areas());
+}
+
+static void different_areas_not_merged(void)
+{
+        struct vm_area *x = vm_new_area_within_space(&SPACE, PAGES(1), PAGES(1));
+        struct vm_area *y = vm_new_area_within_space(&SPACE, PAGES(1), PAGES(1));
+        TEST_ASSERT_NOT_NULL(x);
+        TEST_ASSERT_NOT_NULL(y);
+        x->ops = TEST_OPS;
+        y->ops = TEST_OPS;
+        y->flags = VM_WRITE;
+
+        TEST_ASSERT_EQUAL_PTR(y, vm_merge_area(y));
+        TEST_ASSERT_EQUAL_size_t(0, RELEASED);
+        TEST_ASSERT_EQUAL_size_t(2, count_areas());
+}
+
+/* The space ends at an unaligned address, so dev areas are placed in a hole of a known size. */
+static struct vm_area *new_dev_area(size_t pages)
+{
+        struct vm_area *hole = vm_new_area_within_space(&SPACE, PAGES(pages), PAGES(pages));
+        struct vm_area *fence = vm_new_area_within_space(&SPACE, PAGES(1), PAGES(1));
+        TEST_ASSERT_NOT_NULL(hole);
+        TEST_ASSERT_NOT_NULL(fence);
+        vm_free_area(hole);
+
+        struct vm_area *area = dev_area_new(&SPACE, PAGES(1));
+        TEST_ASSERT_NOT_NULL(area);
+        TEST_ASSERT_EQUAL_size_t(PAGES(pages), area->length);
+        return (area);
+}
+
+static void dev_split_and_merge(void)
+{
+        struct vm_area *area = new_dev_area(8);
+        void *const base = area->base;
+
+        struct vm_area *tail = vm_split_area(area, PAGES(4));
+        TEST_ASSERT_NOT_NULL(tail);
+        TEST_ASSERT_EQUAL_size_t(PAGES(4), area->length);
+        TEST_ASSERT_EQUAL_PTR((uint8_t *)base + PAGES(4), tail->base);
+
+        /* The free regions of both areas are coalesced again. */
+        TEST_ASSERT_EQUAL_PTR(area, vm_merge_area(tail));
+        TEST_ASSERT_EQUAL_size_t(PAGES(8), area->length);
+
+        size_t regions = 0;
+        SLIST_FOREACH (it, area->data) {
+                regions++;
+        }
+        TEST_ASSERT_EQUAL_size_t(1, regions);
+}
+
+static void dev_split_through_occupied(void)
+{
+        struct vm_area *area = new_dev_area(8);
+
+        struct resource res = {
+                .device_id = "test",
+                .resource_id = "buffer",
+                .type = RESOURCE_TYPE_DEV_BUFFER,
+                .data.dev_buffer = { .base = (void *)PAGES(16), .len = PAGES(2) },
+        };
+        void *mapped = vm_area_register_map(area, &res);
+        TEST_ASSERT_EQUAL_PTR(area->base, mapped);
+        TEST_ASSERT_EQUAL_size_t(2, MAPPED_PAGES);
+
+        TEST_ASSERT_NULL(vm_split_area(area, PAGES(1)));
+        TEST_ASSERT_EQUAL_size_t(PAGES(8), area->length);
+
+        /* The occupied region stays with the area, the free one is cut in two. */
+        struct vm_area *tail = vm_split_area(area, PAGES(2));
+        TEST_ASSERT_NOT_NULL(tail);
+        TEST_ASSERT_EQUAL_size_t(PAGES(2), area->length);
+        TEST_ASSERT_EQUAL_size_t(PAGES(6), tail->length);
+
+        TEST_ASSERT_EQUAL_PTR(area, vm_merge_area(tail));
+        TEST_ASSERT_EQUAL_size_t(PAGES(8), area->length);
+}
+
+static void dev_unmap_only_resource(void)
+{
+        struct vm_area *area = new_dev_area(8);
+
+        struct resource res[2] = {
+                {
+                        .device_id = "test",
+                        .resource_id = "first",
+                        .type = RESOURCE_TYPE_DEV_BUFFER,
+                        .data.dev_buffer = { .base = (void *)PAGES(16), .len = PAGES(2) },
+                },
+                {
+                        .device_id = "test",
+                        .resource_id = "second",
+                        .type = RESOURCE_TYPE_DEV_BUFFER,
+                        .data.dev_buffer = { .base = (void *)PAGES(32), .len = PAGES(1) },
+                },
+        };
+        TEST_ASSERT_NOT_NULL(vm_area_register_map(area, &res[0]));
+        TEST_ASSERT_NOT_NULL(vm_area_register_map(area, &res[1]));
+        TEST_ASSERT_EQUAL_size_t(3, MAPPED_PAGES);
+
+        /* The free neighbours are coalesced, but only the pages of the resource are unmapped. */
+        vm_area_unregister_map(area, &res[1]);
+        TEST_ASSERT_EQUAL_size_t(2, MAPPED_PAGES);
+        vm_area_unregister_map(area, &res[0]);
+        TEST_ASSERT_EQUAL_size_t(0, MAPPED_PAGES);
+
+        size_t regions = 0;
+        SLIST_FOREACH (it, area->data) {
+                regions++;
+        }
+        TEST_ASSERT_EQUAL_size_t(1, regions);
+}
+
+int main(void)
+{
+        kmm_init(alloc_page, free_page);
+        vm_init();
+        dev_init();
+
+        UNITY_BEGIN();
+        RUN_TEST(split_and_merge);
+        RUN_TEST(merge_both_neighbours);
+        RUN_TEST(different_areas_not_merged);
+        RUN_TEST(dev_split_and_merge);
+        RUN_TEST(dev_split_through_occupied);
+        RUN_TEST(dev_unmap_only_resource);
+        UNITY_END();
+        return (0);
+}
@@ -0,0 +1,194 @@
+#include "kernel/mm/zstore.h"
+
+#include "kernel/config.h"
+#include "kernel/deferred.h"
+#include "kernel/klog.h"
+#include "kernel/mm/kmm.h"
+#include "kernel/mm/mempool.h"
+#include "kernel/platform_consts.h"
+
+#include "lib/compress/lz.h"
+#include "lib/cppdefs.h"
+#include "lib/cstd/assert.h"
+#include "lib/cstd/string.h"
+#include "lib/ds/rbtree.h"
+#include "lib/utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct zstore_entry {
+        struct rbtree_node node;
+        void const *key;
+        size_t len;
+        uint8_t data[];
+};
+
+/* Pages are stored from the reclaim path, which must not allocate.
+ * So entries are taken from the reserves of their size class, and those are refilled later. */
+struct zstore_class {
+        size_t capacity;
+        struct kmm_cache cache;
+        struct mempool pool;
+        void *reserve[CONF_ZSTORE_RESERVED_ENTRIES];
+};
+
+static struct zstore_class CLASSES[] = {
+        { .capacity = CONF_ZSTORE_MAX_SIZE / 4 },
+        { .capacity = CONF_ZSTORE_MAX_SIZE / 2 },
+        { .capacity = CONF_ZSTORE_MAX_SIZE },
+};
+static char const *const CLASS_NAMES[ARRAY_SIZE(CLASSES)] = {
+        "zstore_small",
+        "zstore_medium",
+        "zstore_large",
+};
+
+static struct rbtree ENTRIES;
+static size_t ENTRIES_COUNT = 0;
+
+/* Compression happens from the reclaim path. So the buffers can't be allocated on demand. */
+static struct lz_state LZ_STATE;
+static uint8_t SCRATCH[CONF_ZSTORE_MAX_SIZE];
+
+static int entry_cmp(void const *tree_entry, void const *entry)
+{
+        uintptr_t const x = (uintptr_t)((struct zstore_entry const *)tree_entry)->key;
+        uintptr_t const y = (uintptr_t)((struct zstore_entry const *)entry)->key;
+        return (x < y ? -1 : x > y);
+}
+
+static int entry_key_cmp(void const *tree_entry, void const *key)
+{
+        uintptr_t const x = (uintptr_t)((struct zstore_entry const *)tree_entry)->key;
+        uintptr_t const y = (uintptr_t)key;
+        return (x < y ? -1 : x > y);
+}
+
+static struct zstore_entry *find_entry(void const *key)
+{
+        struct rbtree_node *node = rbtree_search(&ENTRIES, (void *)(uintptr_t)key, entry_key_cmp);
+        return (node != NULL ? node->data : NULL);
+}
+
+static struct zstore_class *class_of(size_t len)
+{
+        for (size_t i = 0; i < ARRAY_SIZE(CLASSES); i++) {
+                if (len <= CLASSES[i].capacity) {
+                        return (&CLASSES[i]);
+                }
+        }
+        return (NULL);
+}
+
+static void delete_entry(struct zstore_entry *e)
+{
+        rbtree_delete(&ENTRIES, &e->node);
+        ENTRIES_COUNT--;
+        mempool_free(&class_of(e->len)->pool, e);
+}
+
+/* The node points back to its entry for the whole life of the object. */
+static void entry_ctor(void *mem)
+{
+        struct zstore_entry *e = mem;
+        e->node.data = e;
+}
+
+static void refill_reserves(void)
+{
+        for (size_t i = 0; i < ARRAY_SIZE(CLASSES); i++) {
+                if (__unlikely(!mempool_refill(&CLASSES[i].pool))) {
+                        LOGF_W("Couldn't refill the reserve of %s.\n", CLASS_NAMES[i]);
+                }
+        }
+}
+
+static struct deferred_work REFILL_WORK = {
+        .name = "zstore_refill",
+        .fn = refill_reserves,
+};
+
+void zstore_init(void)
+{
+        kassert(PLATFORM_PAGE_SIZE <= LZ_MAX_OFFSET);
+
+        rbtree_init_tree(&ENTRIES);
+        ENTRIES_COUNT = 0;
+
+        for (size_t i = 0; i < ARRAY_SIZE(CLASSES); i++) {
+                struct zstore_class *c = &CLASSES[i];
+                /* Usually only the reserve's worth of entries is ever handed out.
+                 * The rest of a slab isn't worth constructing. */
+                kmm_cache_init(&c->cache, CLASS_NAMES[i],
+                               sizeof(struct zstore_entry) + c->capacity, 0,
+                               KMM_CACHE_LAZY_CTOR, entry_ctor, NULL);
+                mempool_init(&c->pool, c->reserve, ARRAY_SIZE(c->reserve), mempool_alloc_slab,
+                             mempool_free_slab, &c->cache);
+        }
+        refill_reserves();
+        deferred_register(&REFILL_WORK);
+}
+
+bool zstore_store(void const *key, void const *page)
+{
+        kassert(find_entry(key) == NULL);
+
+        size_t const len = lz_compress(&LZ_STATE, page, PLATFORM_PAGE_SIZE, SCRATCH,
+                                       sizeof(SCRATCH));
+        if (len == 0) {
+                return (false);
+        }
+
+        struct zstore_entry *e = mempool_alloc_reserved(&class_of(len)->pool);
+        deferred_schedule(&REFILL_WORK);
+        if (__unlikely(e == NULL)) {
+                return (false);
+        }
+
+        kmemcpy(e->data, SCRATCH, len);
+        e->len = len;
+        e->key = key;
+
+        kassert(e->node.data == e);
+        rbtree_insert(&ENTRIES, &e->node, entry_cmp);
+        ENTRIES_COUNT++;
+
+        return (true);
+}
+
+bool zstore_contains(void const *key)
+{
+        return (ENTRIES_COUNT > 0 && find_entry(key) != NULL);
+}
+
+void zstore_load(void const *key, void *page)
+{
+        struct zstore_entry *e = find_entry(key);
+        kassert(e != NULL);
+
+        size_t const len = lz_decompress(e->data, e->len, page, PLATFORM_PAGE_SIZE);
+        if (__unlikely(len != PLATFORM_PAGE_SIZE)) {
+                LOGF_P("The compressed page %p is corrupted.\n", key);
+        }
+
+        delete_entry(e);
+}
+
+void zstore_drop(void const *key)
+{
+        if (ENTRIES_COUNT == 0) {
+                return;
+        }
+
+        struct zstore_entry *e = find_entry(key);
+        if (e != NULL) {
+                delete_entry(e);
+        }
+}
+
+size_t zstore_pages(void)
+{
+        return (ENTRIES_COUNT);
+}
@@ -0,0 +1,103 @@
+#include "kernel/ramdisk.h"
+
+#include "kernel/blkdev.h"
+#include "kernel/klog.h"
+#include "kernel/mm/kmalloc.h"
+#include "kernel/mm/mm.h"
+#include "kernel/mm/vm.h"
+#include "kernel/platform_consts.h"
+
+#include "lib/cppdefs.h"
+#include "lib/cstd/assert.h"
+#include "lib/cstd/string.h"
+
+#include <stddef.h>
+
+struct ramdisk {
+        struct blkdev dev;
+        phys_addr_t *frames; /**< NULL for blocks without data. */
+};
+
+static int ramdisk_read(struct blkdev *dev, size_t block, void *buf)
+{
+        struct ramdisk *rd = dev->data;
+        if (__unlikely(block >= dev->blocks_count)) {
+                return (BLKDEV_RC_FAIL);
+        }
+
+        if (rd->frames[block] == NULL) {
+                kmemset(buf, 0x0, dev->block_size);
+                return (BLKDEV_RC_OK);
+        }
+
+        void *mem = vm_arch_kmap(rd->frames[block]);
+        kmemcpy(buf, mem, dev->block_size);
+        vm_arch_kunmap(mem);
+
+        return (BLKDEV_RC_OK);
+}
+
+static int ramdisk_write(struct blkdev *dev, size_t block, void const *buf)
+{
+        struct ramdisk *rd = dev->data;
+        if (__unlikely(block >= dev->blocks_count)) {
+                return (BLKDEV_RC_FAIL);
+        }
+
+        if (rd->frames[block] == NULL) {
+                struct mm_page *p = mm_alloc_page();
+                if (__unlikely(p == NULL)) {
+                        return (BLKDEV_RC_FAIL);
+                }
+                rd->frames[block] = p->paddr;
+        }
+
+        void *mem = vm_arch_kmap(rd->frames[block]);
+        kmemcpy(mem, buf, dev->block_size);
+        vm_arch_kunmap(mem);
+
+        return (BLKDEV_RC_OK);
+}
+
+static void ramdisk_discard(struct blkdev *dev, size_t block)
+{
+        struct ramdisk *rd = dev->data;
+        kassert(block < dev->blocks_count);
+
+        if (rd->frames[block] != NULL) {
+                mm_free_page(rd->frames[block]);
+                rd->frames[block] = NULL;
+        }
+}
+
+struct blkdev *ramdisk_create(const char *name, size_t blocks)
+{
+        kassert(blocks > 0);
+
+        struct ramdisk *rd = kmalloc(sizeof(*rd));
+        if (__unlikely(rd == NULL)) {
+                return (NULL);
+        }
+
+        rd->frames = kmalloc(blocks * sizeof(*rd->frames));
+        if (__unlikely(rd->frames == NULL)) {
+                kfree(rd);
+                return (NULL);
+        }
+        for (size_t i = 0; i < blocks; i++) {
+                rd->frames[i] = NULL;
+        }
+
+        rd->dev = (struct blkdev){
+                .name = name,
+                .block_size = PLATFORM_PAGE_SIZE,
+                .blocks_count = blocks,
+                .read = ramdisk_read,
+                .write = ramdisk_write,
+                .discard = ramdisk_discard,
+                .data = rd,
+        };
+
+        LOGF_I("Created the RAM disk %s of %zu blocks\n", name, blocks);
+        return (&rd->dev);
+}
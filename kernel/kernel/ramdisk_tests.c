@@ -0,0 +1,144 @@
+// UNITY_TEST DEPENDS ON: kernel/kernel/ramdisk.c
+// UNITY_TEST DEPENDS ON: kernel/lib/cstd/string/memcpy.c
+// UNITY_TEST DEPENDS ON: kernel/lib/cstd/string/memset.c
+// UNITY_TEST DEPENDS ON: kernel/test_fakes/panic.c
+
+#include "kernel/ramdisk.h"
+
+#include "kernel/blkdev.h"
+#include "kernel/mm/kmalloc.h"
+#include "kernel/mm/mm.h"
+
+#include "lib/utils.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+size_t const PLATFORM_PAGE_SIZE = 4096;
+
+#define BLOCKS (4)
+
+/* The frames are plain memory, so kmap is an identity. */
+static size_t FRAMES_LIMIT = 0;
+static size_t FRAMES_USED = 0;
+static struct mm_page FRAME;
+
+struct mm_page *mm_alloc_page(void)
+{
+        if (FRAMES_USED == FRAMES_LIMIT) {
+                return (NULL);
+        }
+        FRAMES_USED++;
+        FRAME.paddr = aligned_alloc(PLATFORM_PAGE_SIZE, PLATFORM_PAGE_SIZE);
+        FRAME.state = PAGESTATE_OCCUPIED;
+        return (&FRAME);
+}
+
+void mm_free_page(phys_addr_t addr)
+{
+        TEST_ASSERT_NOT_NULL(addr);
+        FRAMES_USED--;
+        free(addr);
+}
+
+void *vm_arch_kmap(phys_addr_t frame)
+{
+        return (frame);
+}
+
+void vm_arch_kunmap(void *addr __unused) {}
+
+void *kmalloc(size_t size)
+{
+        return (malloc(size));
+}
+
+void kfree(void *mem)
+{
+        free(mem);
+}
+
+static struct blkdev *DEV;
+static uint8_t BUFFER[4096];
+static uint8_t DATA[4096];
+
+void setUp(void)
+{
+        TEST_ASSERT_NOT_NULL(DEV);
+        FRAMES_LIMIT = BLOCKS;
+        memset(DATA, 0xA5, sizeof(DATA));
+}
+
+void tearDown(void)
+{
+        for (size_t i = 0; i < BLOCKS; i++) {
+                DEV->discard(DEV, i);
+        }
+        TEST_ASSERT_EQUAL_size_t(0, FRAMES_USED);
+}
+
+static void unwritten_blocks_are_zeroes(void)
+{
+        TEST_ASSERT_EQUAL_size_t(0, FRAMES_USED);
+
+        memset(BUFFER, 0xFF, sizeof(BUFFER));
+        TEST_ASSERT_EQUAL_INT(BLKDEV_RC_OK, DEV->read(DEV, 0, BUFFER));
+        TEST_ASSERT_EACH_EQUAL_CHAR(0x0, BUFFER, sizeof(BUFFER));
+        TEST_ASSERT_EQUAL_size_t(0, FRAMES_USED);
+}
+
+static void write_takes_a_frame(void)
+{
+        TEST_ASSERT_EQUAL_INT(BLKDEV_RC_OK, DEV->write(DEV, 1, DATA));
+        TEST_ASSERT_EQUAL_size_t(1, FRAMES_USED);
+
+        /* Rewriting the block doesn't take another one. */
+        TEST_ASSERT_EQUAL_INT(BLKDEV_RC_OK, DEV->write(DEV, 1, DATA));
+        TEST_ASSERT_EQUAL_size_t(1, FRAMES_USED);
+
+        TEST_ASSERT_EQUAL_INT(BLKDEV_RC_OK, DEV->read(DEV, 1, BUFFER));
+        TEST_ASSERT_EQUAL_HEX8_ARRAY(DATA, BUFFER, sizeof(BUFFER));
+}
+
+static void discard_gives_frame_back(void)
+{
+        TEST_ASSERT_EQUAL_INT(BLKDEV_RC_OK, DEV->write(DEV, 2, DATA));
+        DEV->discard(DEV, 2);
+        TEST_ASSERT_EQUAL_size_t(0, FRAMES_USED);
+
+        TEST_ASSERT_EQUAL_INT(BLKDEV_RC_OK, DEV->read(DEV, 2, BUFFER));
+        TEST_ASSERT_EACH_EQUAL_CHAR(0x0, BUFFER, sizeof(BUFFER));
+}
+
+static void write_fails_without_frames(void)
+{
+        FRAMES_LIMIT = 0;
+        TEST_ASSERT_EQUAL_INT(BLKDEV_RC_FAIL, DEV->write(DEV, 3, DATA));
+        TEST_ASSERT_EQUAL_INT(BLKDEV_RC_OK, DEV->read(DEV, 3, BUFFER));
+        TEST_ASSERT_EACH_EQUAL_CHAR(0x0, BUFFER, sizeof(BUFFER));
+}
+
+static void out_of_range(void)
+{
+        TEST_ASSERT_EQUAL_INT(BLKDEV_RC_FAIL, DEV->write(DEV, BLOCKS, DATA));
+        TEST_ASSERT_EQUAL_INT(BLKDEV_RC_FAIL, DEV->read(DEV, BLOCKS, BUFFER));
+        TEST_ASSERT_EQUAL_size_t(0, FRAMES_USED);
+}
+
+int main(void)
+{
+        DEV = ramdisk_create("test_ram", BLOCKS);
+
+        UNITY_BEGIN();
+        RUN_TEST(unwritten_blocks_are_zeroes);
+        RUN_TEST(write_takes_a_frame);
+        RUN_TEST(discard_gives_frame_back);
+        RUN_TEST(write_fails_without_frames);
+        RUN_TEST(out_of_range);
+        UNITY_END();
+        return (0);
+}
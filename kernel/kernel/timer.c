@@ -1,23 +1,68 @@
 #include "kernel/timer.h"
 
+#include "kernel/config.h"
+#include "kernel/kernel.h"
+#include "kernel/klog.h"
+
+#include "lib/cppdefs.h"
+#include "lib/cstd/assert.h"
 #include "lib/ds/cbuffer.h"
 #include "lib/elflist.h"
+#include "lib/utils.h"
+
+#include <stdbool.h>
 
 ELFLIST_DECLARE(timers);
 
 struct event {
         callback_fn cb;
         unsigned wake_time;
+        unsigned period; /**< Zero for events that fire once. */
 };
 
 static struct int_timer *TIMER;
 static unsigned TIME;
+/* The tick goes through the queue in an interrupt handler.
+ * Everyone else must disable the interrupts while they access it. */
+static CBUFFER_DECLARE(struct event, CONF_TIMER_QUEUE_LENGTH) EVENTS;
+
+static void queue_event(struct event e)
+{
+        if (__unlikely(!CBUFFER_PUSH(&EVENTS, e))) {
+                LOGF_P("The timer queue is full.\n");
+        }
+}
 
 static void callback(void)
-{}
+{
+        bool const irq = kernel_arch_irq_save();
+        TIME += CONF_TIMER_TICK_MS;
+
+        /* Look at every queued event once. Those that aren't due yet or repeat are queued again. */
+        for (size_t left = EVENTS.count; left > 0; left--) {
+                struct event e;
+                CBUFFER_POP(&EVENTS, e, (struct event){ 0 });
+
+                if (e.wake_time > TIME) {
+                        queue_event(e);
+                        continue;
+                }
+
+                e.cb();
+                if (e.period > 0) {
+                        e.wake_time += e.period;
+                        queue_event(e);
+                }
+        }
+        kernel_arch_irq_restore(irq);
+
+        TIMER->inter_after(CONF_TIMER_TICK_MS);
+}
 
 void timer_init(void)
 {
+        CBUFFER_INIT(&EVENTS);
+
         struct int_timer **t;
         ELFLIST_FOREACH (struct int_timer, timers, t) {
                 if ((*t)->init != NULL) {
@@ -29,8 +74,26 @@ void timer_init(void)
                 TIMER = *t;
                 break;
         }
+
+        if (__unlikely(TIMER == NULL)) {
+                LOGF_W("There is no timer. Timed events will never fire.\n");
+                return;
+        }
+        TIMER->inter_after(CONF_TIMER_TICK_MS);
 }
 
 void timer_call_after(unsigned ms, callback_fn f)
 {
+        bool const irq = kernel_arch_irq_save();
+        queue_event((struct event){ .cb = f, .wake_time = TIME + ms, .period = 0 });
+        kernel_arch_irq_restore(irq);
+}
+
+void timer_call_every(unsigned ms, callback_fn f)
+{
+        kassert(ms > 0);
+
+        bool const irq = kernel_arch_irq_save();
+        queue_event((struct event){ .cb = f, .wake_time = TIME + ms, .period = ms });
+        kernel_arch_irq_restore(irq);
 }
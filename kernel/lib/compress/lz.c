@@ -0,0 +1,194 @@
+#include "lib/compress/lz.h"
+
+#include "lib/cppdefs.h"
+#include "lib/cstd/assert.h"
+#include "lib/cstd/string.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define NIBBLE_MAX (15U)
+
+static uint32_t read32(uint8_t const *p)
+{
+        return ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+                (uint32_t)p[3] << 24);
+}
+
+static unsigned hash(uint32_t seq)
+{
+        /* Knuth's multiplicative hashing. */
+        return ((seq * 2654435761U) >> (32 - LZ_HASH_BITS));
+}
+
+/* The part of a length that doesn't fit into the token's nibble. */
+static bool put_length_tail(uint8_t **op, uint8_t const *oend, size_t len)
+{
+        if (len < NIBBLE_MAX) {
+                return (true);
+        }
+
+        len -= NIBBLE_MAX;
+        do {
+                if (*op == oend) {
+                        return (false);
+                }
+                uint8_t const b = len >= 255 ? 255 : (uint8_t)len;
+                *(*op)++ = b;
+                len -= b;
+                /* A length that is a multiple of 255 is ended with an explicit zero. */
+                if (b < 255) {
+                        break;
+                }
+        } while (true);
+
+        return (true);
+}
+
+static bool put_sequence(uint8_t **op, uint8_t const *oend, uint8_t const *literals,
+                         size_t lit_len, size_t offset, size_t match_len)
+{
+        if (*op == oend) {
+                return (false);
+        }
+
+        uint8_t *token = (*op)++;
+        size_t const lit_nibble = lit_len < NIBBLE_MAX ? lit_len : NIBBLE_MAX;
+        *token = (uint8_t)(lit_nibble << 4);
+
+        if (!put_length_tail(op, oend, lit_len)) {
+                return (false);
+        }
+        if ((size_t)(oend - *op) < lit_len) {
+                return (false);
+        }
+        kmemcpy(*op, literals, lit_len);
+        *op += lit_len;
+
+        if (match_len == 0) {
+                return (true);
+        }
+
+        if (oend - *op < 2) {
+                return (false);
+        }
+        *(*op)++ = (uint8_t)(offset & 0xFF);
+        *(*op)++ = (uint8_t)(offset >> 8);
+
+        size_t const ml = match_len - LZ_MIN_MATCH;
+        *token |= (uint8_t)(ml < NIBBLE_MAX ? ml : NIBBLE_MAX);
+        return (put_length_tail(op, oend, ml));
+}
+
+size_t lz_compress(struct lz_state *st, void const *src, size_t src_len, void *dst,
+                   size_t dst_cap)
+{
+        kassert(st != NULL);
+        kassert(src_len <= LZ_MAX_OFFSET);
+
+        uint8_t const *const in = src;
+        uint8_t *op = dst;
+        uint8_t const *const oend = op + dst_cap;
+
+        kmemset(st->table, 0x0, sizeof(st->table));
+
+        size_t anchor = 0;
+        size_t ip = 0;
+        while (ip + LZ_MIN_MATCH <= src_len) {
+                uint32_t const seq = read32(&in[ip]);
+                unsigned const h = hash(seq);
+                size_t const cand = st->table[h];
+                st->table[h] = (uint16_t)ip;
+
+                if (cand >= ip || read32(&in[cand]) != seq) {
+                        ip++;
+                        continue;
+                }
+
+                size_t len = LZ_MIN_MATCH;
+                while (ip + len < src_len && in[cand + len] == in[ip + len]) {
+                        len++;
+                }
+
+                if (!put_sequence(&op, oend, &in[anchor], ip - anchor, ip - cand, len)) {
+                        return (0);
+                }
+                ip += len;
+                anchor = ip;
+        }
+
+        if (!put_sequence(&op, oend, &in[anchor], src_len - anchor, 0, 0)) {
+                return (0);
+        }
+
+        return ((size_t)(op - (uint8_t *)dst));
+}
+
+static bool get_length(uint8_t const **ip, uint8_t const *iend, size_t *len)
+{
+        if (*len < NIBBLE_MAX) {
+                return (true);
+        }
+
+        uint8_t b = 0;
+        do {
+                if (*ip == iend) {
+                        return (false);
+                }
+                b = *(*ip)++;
+                *len += b;
+        } while (b == 255);
+
+        return (true);
+}
+
+size_t lz_decompress(void const *src, size_t src_len, void *dst, size_t dst_cap)
+{
+        uint8_t const *ip = src;
+        uint8_t const *const iend = ip + src_len;
+        uint8_t *const out = dst;
+        size_t op = 0;
+
+        while (ip < iend) {
+                uint8_t const token = *ip++;
+
+                size_t lit_len = token >> 4;
+                if (!get_length(&ip, iend, &lit_len)) {
+                        return (0);
+                }
+                if ((size_t)(iend - ip) < lit_len || dst_cap - op < lit_len) {
+                        return (0);
+                }
+                kmemcpy(&out[op], ip, lit_len);
+                ip += lit_len;
+                op += lit_len;
+
+                /* The last sequence has no match. */
+                if (ip == iend) {
+                        break;
+                }
+
+                if (iend - ip < 2) {
+                        return (0);
+                }
+                size_t const offset = (size_t)ip[0] | (size_t)ip[1] << 8;
+                ip += 2;
+
+                size_t match_len = token & NIBBLE_MAX;
+                if (!get_length(&ip, iend, &match_len)) {
+                        return (0);
+                }
+                match_len += LZ_MIN_MATCH;
+
+                if (offset == 0 || offset > op || dst_cap - op < match_len) {
+                        return (0);
+                }
+                /* Matches may overlap the bytes they produce. */
+                for (size_t i = 0; i < match_len; i++, op++) {
+                        out[op] = out[op - offset];
+                }
+        }
+
+        return (op);
+}
@@ -0,0 +1,128 @@
+/* UNITY_TEST DEPENDS ON: kernel/lib/compress/lz.c
+ * UNITY_TEST DEPENDS ON: kernel/lib/cstd/string/memcpy.c
+ * UNITY_TEST DEPENDS ON: kernel/lib/cstd/string/memset.c
+ * UNITY_TEST DEPENDS ON: kernel/test_fakes/panic.c
+ */
+
+#include "lib/compress/lz.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unity.h>
+
+#define BUF_SIZE (4096)
+
+static struct lz_state STATE;
+static uint8_t SRC[BUF_SIZE];
+static uint8_t COMPRESSED[BUF_SIZE * 2];
+static uint8_t DST[BUF_SIZE];
+
+void setUp(void)
+{
+        memset(DST, 0xAB, sizeof(DST));
+}
+
+void tearDown(void)
+{
+}
+
+static size_t roundtrip(size_t len)
+{
+        size_t const clen = lz_compress(&STATE, SRC, len, COMPRESSED, sizeof(COMPRESSED));
+        TEST_ASSERT_TRUE(clen > 0);
+
+        size_t const dlen = lz_decompress(COMPRESSED, clen, DST, sizeof(DST));
+        TEST_ASSERT_EQUAL_size_t(len, dlen);
+        TEST_ASSERT_EQUAL_INT(0, memcmp(SRC, DST, len));
+
+        return (clen);
+}
+
+static void zeroes_compress_well(void)
+{
+        memset(SRC, 0x0, sizeof(SRC));
+        size_t const clen = roundtrip(sizeof(SRC));
+        TEST_ASSERT_TRUE(clen < 64);
+}
+
+static void repeated_pattern(void)
+{
+        static uint8_t const pattern[] = { 'y', 'a', 'e', 'o', 's' };
+        for (size_t i = 0; i < sizeof(SRC); i++) {
+                SRC[i] = pattern[i % sizeof(pattern)];
+        }
+        size_t const clen = roundtrip(sizeof(SRC));
+        TEST_ASSERT_TRUE(clen < 64);
+}
+
+static void random_data(void)
+{
+        srand(42);
+        for (size_t i = 0; i < sizeof(SRC); i++) {
+                SRC[i] = (uint8_t)rand();
+        }
+        roundtrip(sizeof(SRC));
+}
+
+static void mixed_data(void)
+{
+        srand(7);
+        for (size_t i = 0; i < sizeof(SRC); i++) {
+                /* Runs of random lengths, including the ones that need length bytes. */
+                size_t run = (size_t)rand() % 600;
+                uint8_t const b = (uint8_t)rand();
+                for (; run > 0 && i < sizeof(SRC); run--, i++) {
+                        SRC[i] = b;
+                }
+                if (i < sizeof(SRC)) {
+                        SRC[i] = (uint8_t)rand();
+                }
+        }
+        roundtrip(sizeof(SRC));
+}
+
+static void short_inputs(void)
+{
+        memcpy(SRC, "abcabcabc", 9);
+        for (size_t len = 1; len <= 9; len++) {
+                roundtrip(len);
+        }
+}
+
+static void small_destination(void)
+{
+        srand(1);
+        for (size_t i = 0; i < sizeof(SRC); i++) {
+                SRC[i] = (uint8_t)rand();
+        }
+        TEST_ASSERT_EQUAL_size_t(0, lz_compress(&STATE, SRC, sizeof(SRC), COMPRESSED, 1024));
+
+        memset(SRC, 0x0, sizeof(SRC));
+        size_t const clen = lz_compress(&STATE, SRC, sizeof(SRC), COMPRESSED, sizeof(COMPRESSED));
+        TEST_ASSERT_EQUAL_size_t(0, lz_decompress(COMPRESSED, clen, DST, sizeof(SRC) - 1));
+}
+
+static void malformed_stream(void)
+{
+        /* A match that points before the start of the output. */
+        uint8_t const bad_offset[] = { 0x10, 'a', 0x05, 0x00 };
+        TEST_ASSERT_EQUAL_size_t(0, lz_decompress(bad_offset, sizeof(bad_offset), DST, 16));
+
+        /* Literals past the end of the stream. */
+        uint8_t const truncated[] = { 0x50, 'a', 'b' };
+        TEST_ASSERT_EQUAL_size_t(0, lz_decompress(truncated, sizeof(truncated), DST, 16));
+}
+
+int main(void)
+{
+        UNITY_BEGIN();
+        RUN_TEST(zeroes_compress_well);
+        RUN_TEST(repeated_pattern);
+        RUN_TEST(random_data);
+        RUN_TEST(mixed_data);
+        RUN_TEST(short_inputs);
+        RUN_TEST(small_destination);
+        RUN_TEST(malformed_stream);
+        UNITY_END();
+        return (0);
+}
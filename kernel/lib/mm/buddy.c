@@ -78,23 +78,29 @@ static void occupy_buddy(struct buddy_manager *bmgr, size_t lvl, size_t bit)
         occupy_buddys_descendants(bmgr, lvl, bit);
 
         /* Occupy buddy and it's ancestors. */
-        for (size_t i = 0; i < bmgr->lvls; i++) {
+        for (size_t i = lvl; i < bmgr->lvls; i++) {
+                size_t const ancestor = bit >> (i - lvl);
                 /* Guard against trailing 1 when length is odd. */
-                if (bit >> i < bmgr->lvl_bitmaps[i].length) {
-                        bitmap_set_true(&bmgr->lvl_bitmaps[i], bit >> i);
+                if (ancestor < bmgr->lvl_bitmaps[i].length) {
+                        bitmap_set_true(&bmgr->lvl_bitmaps[i], ancestor);
                 }
         }
 }
 
 static void free_buddys_ancestors(struct buddy_manager *bmgr, size_t lvl, size_t bit)
 {
-        while (lvl <= bmgr->lvls) {
+        while (lvl + 1 < bmgr->lvls) {
                 lvl++;
                 bit >>= 1;
 
-                bool left_child_free = bitmap_get(&bmgr->lvl_bitmaps[lvl - 1], bit << 1);
-                bool right_child_free = bitmap_get(&bmgr->lvl_bitmaps[lvl - 1], (bit << 1) + 1);
-                if (!left_child_free || !right_child_free) {
+                /* Trailing buddy of an odd level doesn't have a parent. */
+                if (bit >= bmgr->lvl_bitmaps[lvl].length) {
+                        return;
+                }
+
+                bool left_child_used = bitmap_get(&bmgr->lvl_bitmaps[lvl - 1], bit << 1);
+                bool right_child_used = bitmap_get(&bmgr->lvl_bitmaps[lvl - 1], (bit << 1) + 1);
+                if (left_child_used || right_child_used) {
                         return;
                 }
 
@@ -126,33 +132,39 @@ static void free_buddy(struct buddy_manager *bmgr, size_t lvl, size_t bit)
 bool buddy_try_alloc(struct buddy_manager *bmgr, size_t order, size_t page_ndx)
 {
         kassert(bmgr != NULL);
+        kassert(order < bmgr->lvls);
+        kassert(check_align(page_ndx, (size_t)1 << order));
 
-        if (__unlikely(bitmap_get(&bmgr->lvl_bitmaps[order], page_ndx))) {
+        size_t const bit = page_ndx >> order;
+        if (__unlikely(bitmap_get(&bmgr->lvl_bitmaps[order], bit))) {
                 return (false);
         }
-        occupy_buddy(bmgr, order, page_ndx);
+        occupy_buddy(bmgr, order, bit);
         return (true);
 }
 
 bool buddy_alloc(struct buddy_manager *bmgr, size_t order, size_t *result)
 {
-        if (order > bmgr->lvls) {
+        if (order >= bmgr->lvls) {
                 return (false);
         }
 
-        size_t ndx = 0;
-        if (!bitmap_search_false(&bmgr->lvl_bitmaps[order], &ndx)) {
+        size_t bit = 0;
+        if (!bitmap_search_false(&bmgr->lvl_bitmaps[order], &bit)) {
                 return (false);
         }
 
-        occupy_buddy(bmgr, order, ndx);
-        *result = ndx;
+        occupy_buddy(bmgr, order, bit);
+        *result = bit << order;
         return (true);
 }
 
 void buddy_free(struct buddy_manager *bmgr, size_t page_ndx, size_t order)
 {
-        free_buddy(bmgr, order, page_ndx);
+        kassert(order < bmgr->lvls);
+        kassert(check_align(page_ndx, (size_t)1 << order));
+
+        free_buddy(bmgr, order, page_ndx >> order);
 }
 
 bool buddy_is_free(struct buddy_manager *bmgr, size_t page_ndx)
@@ -91,6 +91,53 @@ static void free_works(void)
                 "We know that the allocator has one more page but it is hiding it!");
 }
 
+static void higher_order_blocks_are_aligned(void)
+{
+        size_t ndx1 = 0;
+        TEST_ASSERT_TRUE(buddy_alloc(&buddym, 0, &ndx1));
+
+        size_t ndx2 = 0;
+        TEST_ASSERT_TRUE(buddy_alloc(&buddym, 3, &ndx2));
+        TEST_ASSERT_EQUAL_size_t(0, ndx2 % 8);
+        TEST_ASSERT_TRUE_MESSAGE(ndx1 < ndx2 || ndx1 >= ndx2 + 8, "The blocks overlap.");
+
+        for (size_t i = 0; i < 8; i++) {
+                TEST_ASSERT_FALSE(buddy_is_free(&buddym, ndx2 + i));
+        }
+}
+
+static void freed_pages_merge_into_block(void)
+{
+        size_t const order = log2_floor(number_of_pages);
+        for (size_t i = 0; i < number_of_pages; i++) {
+                size_t tmp __unused;
+                TEST_ASSERT_TRUE(buddy_alloc(&buddym, 0, &tmp));
+        }
+
+        size_t ndx = 0;
+        TEST_ASSERT_FALSE(buddy_alloc(&buddym, order, &ndx));
+
+        for (size_t i = 0; i < number_of_pages; i++) {
+                buddy_free(&buddym, i, 0);
+        }
+
+        TEST_ASSERT_TRUE_MESSAGE(buddy_alloc(&buddym, order, &ndx),
+                                 "Freed pages haven't been merged back.");
+        TEST_ASSERT_EQUAL_size_t(0, ndx);
+}
+
+static void block_tail_can_be_freed(void)
+{
+        size_t ndx = 0;
+        TEST_ASSERT_TRUE(buddy_alloc(&buddym, 2, &ndx));
+
+        buddy_free(&buddym, ndx + 3, 0);
+        TEST_ASSERT_FALSE(buddy_is_free(&buddym, ndx + 2));
+        TEST_ASSERT_TRUE(buddy_is_free(&buddym, ndx + 3));
+        TEST_ASSERT_TRUE(buddy_try_alloc(&buddym, 0, ndx + 3));
+        TEST_ASSERT_FALSE(buddy_try_alloc(&buddym, 1, ndx + 2));
+}
+
 int main(void)
 {
         UNITY_BEGIN();
@@ -99,6 +146,9 @@ int main(void)
         RUN_TEST(cant_allocate_more_than_own);
         RUN_TEST(no_missing_memory);
         RUN_TEST(free_works);
+        RUN_TEST(higher_order_blocks_are_aligned);
+        RUN_TEST(freed_pages_merge_into_block);
+        RUN_TEST(block_tail_can_be_freed);
         UNITY_END();
         return (0);
 }
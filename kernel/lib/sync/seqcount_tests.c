@@ -0,0 +1,60 @@
+#include "lib/sync/seqcount.h"
+#include "lib/sync/spinlock.h"
+
+#include <stdbool.h>
+#include <unity.h>
+
+void setUp(void)
+{}
+
+void tearDown(void)
+{}
+
+static void read_without_writers_succeeds(void)
+{
+        struct seqcount s;
+        seqcount_init(&s);
+
+        unsigned seq = seqcount_read_begin(&s);
+        TEST_ASSERT_FALSE(seqcount_read_retry(&s, seq));
+}
+
+static void read_during_write_is_retried(void)
+{
+        struct seqcount s;
+        seqcount_init(&s);
+
+        unsigned seq = seqcount_read_begin(&s);
+        seqcount_write_begin(&s);
+        TEST_ASSERT_TRUE(seqcount_read_retry(&s, seq));
+        seqcount_write_end(&s);
+        TEST_ASSERT_TRUE(seqcount_read_retry(&s, seq));
+
+        seq = seqcount_read_begin(&s);
+        TEST_ASSERT_FALSE(seqcount_read_retry(&s, seq));
+}
+
+static void spinlock_is_exclusive(void)
+{
+        struct spinlock l;
+        spinlock_init(&l);
+        TEST_ASSERT_FALSE(spinlock_is_locked(&l));
+
+        spinlock_lock(&l);
+        TEST_ASSERT_TRUE(spinlock_is_locked(&l));
+        TEST_ASSERT_FALSE(spinlock_trylock(&l));
+
+        spinlock_unlock(&l);
+        TEST_ASSERT_TRUE(spinlock_trylock(&l));
+        spinlock_unlock(&l);
+}
+
+int main(void)
+{
+        UNITY_BEGIN();
+        RUN_TEST(read_without_writers_succeeds);
+        RUN_TEST(read_during_write_is_retried);
+        RUN_TEST(spinlock_is_exclusive);
+        UNITY_END();
+        return (0);
+}
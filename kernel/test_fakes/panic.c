@@ -60,6 +60,24 @@ __weak void kernel_panic(struct kernel_panic_info *info)
         TEST_FAIL();
 }
 
+__weak void klog_logf_panic(const char *location, const char *restrict format, ...)
+{
+        char buffer[2048];
+
+        va_list ap;
+        va_start(ap, format);
+        vsnprintf(buffer, sizeof(buffer), format, ap);
+        va_end(ap);
+
+        fprintf(stderr, "Panic at %s: %s", location, buffer);
+        abort();
+}
+
+__weak unsigned kernel_arch_get_cpu_id(void)
+{
+        return (0);
+}
+
 __noreturn void assertion_fail(char const *failed_expression, char const *location)
 {
         if (failed_kassert_expecting()) {